@@ -0,0 +1,523 @@
+// Headless benchmark of the ofxTrueTypeFontUC hot paths.
+//
+// It needs neither a window nor a GL context: glyphs are rasterized into
+// the CPU side of the atlas and only uploaded when something is drawn.
+// The addon is compiled into this file so that its internals can be timed
+// directly, so don't add ofxTrueTypeFontUC to this project's addons.
+//
+// usage: benchmark [font] [cjk font] > results.json
+//        benchmark --check [font]
+//
+// --check runs consistency checks of the atlas and the drawing instead,
+// the process fails when one of them does. it opens a small window with
+// a GL 3.2 context, as checking the textures needs one and the text
+// shader is only used by the programmable renderer.
+
+#include "ofMain.h"
+#include "ofxTrueTypeFontUC.cpp"
+
+#include <chrono>
+
+//--------------------------------------------------------------
+static const char *kAsciiCorpus =
+  "The city council met on Tuesday evening to discuss the new budget for public transport. "
+  "After three hours of debate, members agreed to extend night bus services to the harbour "
+  "district and to repair 42 stations before the end of the year. Tickets will cost $2.50.";
+
+static const char *kJapaneseCorpus =
+  "気象庁によると、大型の台風十号は二十日の朝に九州南部へ接近する見込みです。"
+  "各地の自治体は避難所を開設し、住民に早めの避難を呼びかけています。"
+  "鉄道各社は計画運休を発表し、航空便も三百便以上が欠航となりました。"
+  "東京の株式市場では、円相場の動きを受けて輸出関連株が値下がりしました。";
+
+static const char *kMixedCorpus =
+  "今日の会議は10時から😀 新产品发布会将于下周举行🎉 서울의 날씨는 맑음☀️ "
+  "東京→大阪 2時間30分🚄 價格：¥12,800（税込）👍 오늘도 화이팅💪 乾杯🍻";
+
+typedef struct {
+  string name;
+  const char *text;
+} corpusUC;
+
+static const corpusUC kCorpora[] = {
+  {"ascii", kAsciiCorpus},
+  {"japanese", kJapaneseCorpus},
+  {"mixed", kMixedCorpus},
+};
+static const int kNumCorpora = sizeof(kCorpora) / sizeof(kCorpora[0]);
+static const int kSizes[] = {12, 32, 64};
+static const int kNumSizes = sizeof(kSizes) / sizeof(kSizes[0]);
+static const int kGlyphSets[] = {100, 1000, 5000};
+static const int kNumGlyphSets = sizeof(kGlyphSets) / sizeof(kGlyphSets[0]);
+static const int kLabelCounts[] = {1000, 10000};
+static const int kNumLabelCounts = sizeof(kLabelCounts) / sizeof(kLabelCounts[0]);
+
+// each measurement runs for at least this long
+static const double kMinSeconds = 0.2;
+
+// results are stored here so the compiler can't drop the work
+static volatile size_t sinkUC;
+
+//--------------------------------------------------------------
+class ofxTrueTypeFontUCBenchmark {
+public:
+  ofxTrueTypeFontUCBenchmark(const string &font, const string &cjkFont)
+  :font_(font), cjkFont_(cjkFont), first_(true) {}
+
+  void run() {
+    cout << "{\n  \"benchmarks\": [";
+    benchConvToUTF32();
+    benchGetCharID();
+    benchLoadChar();
+    benchStringBoundingBox();
+    benchStringAsPoints();
+    benchMakeContours();
+    benchDrawStrings();
+    cout << "\n  ]\n}" << endl;
+  }
+
+  bool check() {
+    bool ok = true;
+    ok = checkColorPageEviction() && ok;
+    ok = checkContextLoss(false) && ok;
+    ok = checkContextLoss(true) && ok;
+    ok = checkTint() && ok;
+    return ok;
+  }
+
+private:
+  typedef chrono::steady_clock clockUC;
+
+  string font_;
+  string cjkFont_;
+  bool first_;
+
+  const string & fontFor(const corpusUC &corpus) {
+    return corpus.name == "ascii" ? font_ : cjkFont_;
+  }
+
+  bool load(ofxTrueTypeFontUC &font, const corpusUC &corpus, int size, bool makeContours=false) {
+    if (font.loadFont(fontFor(corpus), size, true, makeContours))
+      return true;
+    ofLogError("benchmark") << "couldn't load \"" << fontFor(corpus) << "\"";
+    return false;
+  }
+
+  static double seconds(clockUC::time_point begin) {
+    return chrono::duration<double>(clockUC::now() - begin).count();
+  }
+
+  // runs fn(iterations) with growing counts until it takes long enough,
+  // fn returns the time spent on the part being measured
+  template<class F> static double measure(F fn, long long &iterations) {
+    iterations = 1;
+    while (true) {
+      double spent = fn(iterations);
+      if (spent >= kMinSeconds || iterations >= (1LL << 40))
+        return spent / iterations * 1e9;
+      iterations *= 2;
+    }
+  }
+
+  void report(const string &name, const string &corpus, int size, int glyphs,
+              long long iterations, double nsPerOp, double bytesPerOp) {
+    cout << (first_ ? "\n" : ",\n");
+    first_ = false;
+    cout << "    {\"name\": \"" << name << "\", \"corpus\": \"" << corpus << "\", \"size\": " << size
+         << ", \"glyphs\": " << glyphs << ", \"iterations\": " << iterations
+         << ", \"ns_per_op\": " << nsPerOp;
+    if (bytesPerOp > 0)
+      cout << ", \"mb_per_sec\": " << bytesPerOp / nsPerOp * 1e3;
+    cout << "}";
+    ofLogNotice("benchmark") << name << " " << corpus << " size " << size << ": " << nsPerOp << " ns/op";
+  }
+
+  static bool report(const string &check, bool ok, const string &detail) {
+    if (ok)
+      ofLogNotice("benchmark") << check << " passed: " << detail;
+    else
+      ofLogError("benchmark") << check << " failed: " << detail;
+    return ok;
+  }
+
+  static vector<ofPixels> readAtlas(ofxTrueTypeFontUC::Impl *impl) {
+    vector<ofPixels> pages(impl->atlasPages.size());
+    for (int i = 0; i < (int)pages.size(); ++i)
+      impl->atlasPages[i].texture.readToPixels(pages[i]);
+    return pages;
+  }
+
+  static vector<unsigned int> distinctCharacters(const string &text) {
+    basic_string<unsigned int> codes = convToUTF32(text);
+    vector<unsigned int> chars(codes.begin(), codes.end());
+    sort(chars.begin(), chars.end());
+    chars.erase(unique(chars.begin(), chars.end()), chars.end());
+    chars.erase(remove(chars.begin(), chars.end(), (unsigned int)' '), chars.end());
+    chars.erase(remove(chars.begin(), chars.end(), (unsigned int)'\n'), chars.end());
+    return chars;
+  }
+
+  //--------------------------------------------------------------
+  void benchConvToUTF32() {
+    for (int c = 0; c < kNumCorpora; ++c) {
+      string text = kCorpora[c].text;
+      long long iterations;
+      double ns = measure([&](long long n) {
+        clockUC::time_point begin = clockUC::now();
+        for (long long i = 0; i < n; ++i)
+          sinkUC = convToUTF32(text).size();
+        return seconds(begin);
+      }, iterations);
+      report("convToUTF32", kCorpora[c].name, 0, 0, iterations, ns, text.size());
+    }
+  }
+
+  //--------------------------------------------------------------
+  void benchGetCharID() {
+    for (int c = 0; c < kNumCorpora; ++c) {
+      basic_string<unsigned int> codes = convToUTF32(kCorpora[c].text);
+      for (int g = 0; g < kNumGlyphSets; ++g) {
+        ofxTrueTypeFontUC font;
+        if (!load(font, kCorpora[c], 12))
+          return;
+        ofxTrueTypeFontUC::Impl *impl = font.mImpl;
+
+        // fill the glyph set with ideographs the corpus doesn't use
+        for (int i = 0; (int)impl->loadedChars.size() < kGlyphSets[g]; ++i)
+          impl->getCharID(0x4e00 + i * 7);
+        for (size_t i = 0; i < codes.size(); ++i)
+          impl->getCharID(codes[i]);
+
+        long long iterations;
+        double ns = measure([&](long long n) {
+          clockUC::time_point begin = clockUC::now();
+          for (long long i = 0; i < n; ++i) {
+            for (size_t k = 0; k < codes.size(); ++k)
+              sinkUC = impl->getCharID(codes[k]);
+          }
+          return seconds(begin);
+        }, iterations);
+        report("getCharID", kCorpora[c].name, 12, kGlyphSets[g], iterations * codes.size(),
+               ns / codes.size(), 0);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------
+  void benchLoadChar() {
+    for (int c = 0; c < kNumCorpora; ++c) {
+      vector<unsigned int> chars = distinctCharacters(kCorpora[c].text);
+      for (int s = 0; s < kNumSizes; ++s) {
+        ofxTrueTypeFontUC font;
+        if (!load(font, kCorpora[c], kSizes[s]))
+          return;
+        ofxTrueTypeFontUC::Impl *impl = font.mImpl;
+
+        long long iterations;
+        double ns = measure([&](long long n) {
+          double spent = 0;
+          for (long long i = 0; i < n; ++i) {
+            // start from an empty cache every round, outside of the timing
+            impl->implReserveCharacters(impl->limitCharactersNum_);
+            vector<int> ids;
+            for (size_t k = 0; k < chars.size(); ++k)
+              ids.push_back(impl->getCharID(chars[k]));
+
+            clockUC::time_point begin = clockUC::now();
+            for (size_t k = 0; k < ids.size(); ++k)
+              impl->loadChar(ids[k]);
+            spent += seconds(begin);
+          }
+          return spent;
+        }, iterations);
+        report("loadChar", kCorpora[c].name, kSizes[s], chars.size(), iterations * chars.size(),
+               ns / chars.size(), 0);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------
+  void benchStringBoundingBox() {
+    for (int c = 0; c < kNumCorpora; ++c) {
+      string text = kCorpora[c].text;
+      for (int s = 0; s < kNumSizes; ++s) {
+        ofxTrueTypeFontUC font;
+        if (!load(font, kCorpora[c], kSizes[s]))
+          return;
+        font.getStringBoundingBox(text, 0, 0);
+
+        long long iterations;
+        double ns = measure([&](long long n) {
+          clockUC::time_point begin = clockUC::now();
+          for (long long i = 0; i < n; ++i)
+            sinkUC = font.getStringBoundingBox(text, 0, 0).width;
+          return seconds(begin);
+        }, iterations);
+        report("getStringBoundingBox", kCorpora[c].name, kSizes[s], 0, iterations, ns, text.size());
+
+        ns = measure([&](long long n) {
+          clockUC::time_point begin = clockUC::now();
+          for (long long i = 0; i < n; ++i)
+            sinkUC = font.stringWidth(text);
+          return seconds(begin);
+        }, iterations);
+        report("stringWidth", kCorpora[c].name, kSizes[s], 0, iterations, ns, text.size());
+      }
+    }
+  }
+
+  //--------------------------------------------------------------
+  void benchStringAsPoints() {
+    for (int c = 0; c < kNumCorpora; ++c) {
+      string text = kCorpora[c].text;
+      for (int s = 0; s < kNumSizes; ++s) {
+        ofxTrueTypeFontUC font;
+        if (!load(font, kCorpora[c], kSizes[s], true))
+          return;
+        // vflip is passed explicitly, there is no renderer to ask
+        font.getStringAsPoints(text, true);
+
+        long long iterations;
+        double ns = measure([&](long long n) {
+          clockUC::time_point begin = clockUC::now();
+          for (long long i = 0; i < n; ++i)
+            sinkUC = font.getStringAsPoints(text, true).size();
+          return seconds(begin);
+        }, iterations);
+        report("getStringAsPoints", kCorpora[c].name, kSizes[s], 0, iterations, ns, text.size());
+      }
+    }
+  }
+
+  //--------------------------------------------------------------
+  void benchMakeContours() {
+    for (int c = 0; c < kNumCorpora; ++c) {
+      vector<unsigned int> chars = distinctCharacters(kCorpora[c].text);
+      for (int s = 0; s < kNumSizes; ++s) {
+        ofxTrueTypeFontUC font;
+        if (!load(font, kCorpora[c], kSizes[s]))
+          return;
+        FT_Face face = font.mImpl->face_;
+
+        long long iterations;
+        double ns = measure([&](long long n) {
+          double spent = 0;
+          for (long long i = 0; i < n; ++i) {
+            for (size_t k = 0; k < chars.size(); ++k) {
+              // loading the outline isn't part of the measurement
+              FT_Load_Glyph(face, FT_Get_Char_Index(face, chars[k]), FT_LOAD_DEFAULT);
+              clockUC::time_point begin = clockUC::now();
+              sinkUC = makeContoursForCharacter(face).getOutline().size();
+              spent += seconds(begin);
+            }
+          }
+          return spent;
+        }, iterations);
+        report("makeContoursForCharacter", kCorpora[c].name, kSizes[s], chars.size(),
+               iterations * chars.size(), ns / chars.size(), 0);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------
+  // the cpu side of drawStrings(): decoding, glyph lookup and the quads of
+  // every label, as for a map or a chart. glyphs is the number of labels
+  void benchDrawStrings() {
+    const corpusUC &corpus = kCorpora[0];
+    vector<string> words = ofSplitString(corpus.text, " ", true);
+    for (int c = 0; c < kNumLabelCounts; ++c) {
+      ofxTrueTypeFontUC font;
+      if (!load(font, corpus, 12))
+        return;
+      ofxTrueTypeFontUC::Impl *impl = font.mImpl;
+
+      vector<ofxTrueTypeFontUC::TextItem> items;
+      size_t bytes = 0;
+      for (int i = 0; i < kLabelCounts[c]; ++i) {
+        string label = words[i % words.size()] + " " + ofToString(i);
+        items.push_back(ofxTrueTypeFontUC::TextItem(label, (i % 100) * 20, (i / 100) * 14, ofFloatColor(1), 1, i % 7 ? 0 : 30));
+        bytes += label.size();
+      }
+      impl->layoutStrings(&items[0], items.size());
+
+      long long iterations;
+      double ns = measure([&](long long n) {
+        clockUC::time_point begin = clockUC::now();
+        for (long long i = 0; i < n; ++i)
+          impl->layoutStrings(&items[0], items.size());
+        return seconds(begin);
+      }, iterations);
+      report("drawStringsLayout", corpus.name, 12, kLabelCounts[c], iterations, ns, bytes);
+    }
+  }
+
+  //--------------------------------------------------------------
+  // past the color page limit, a page is only evicted when the one being
+  // filled is full. the rects stand in for emoji, no color font is needed
+  bool checkColorPageEviction() {
+    ofxTrueTypeFontUC font;
+    if (!font.loadFont(font_, 12))
+      return report("colorPageEviction", false, "couldn't load \"" + font_ + "\"");
+    ofxTrueTypeFontUC::Impl *impl = font.mImpl;
+    const int kLimit = 2;
+    const int kRectSize = 256;
+    const int kPageRects = (impl->kAtlasPageSize / kRectSize) * (impl->kAtlasPageSize / kRectSize);
+    const int kPagesFilled = 6;
+    font.setColorPageLimit(kLimit);
+
+    int evictions = 0;
+    int page, x, y;
+    for (int i = 0; i < kPageRects * kPagesFilled; ++i) {
+      unsigned int generation = impl->generation_;
+      impl->allocateAtlasRect(kRectSize, kRectSize, 4, page, x, y);
+      // one per draw, so that every page but the one in use can be evicted
+      impl->drawCount_++;
+      if (impl->generation_ != generation)
+        evictions++;
+    }
+    int colorPages = 0;
+    for (int i = 0; i < (int)impl->atlasPages.size(); ++i) {
+      if (impl->atlasPages[i].channels == 4)
+        colorPages++;
+    }
+    return report("colorPageEviction", evictions == kPagesFilled - kLimit && colorPages == kLimit,
+                  ofToString(evictions) + " evictions and " + ofToString(colorPages) + " color pages for " +
+                  ofToString(kPagesFilled) + " filled pages, expected " + ofToString(kPagesFilled - kLimit) +
+                  " and " + ofToString(kLimit));
+  }
+
+  //--------------------------------------------------------------
+  // a lost context, as far as the font can tell: the pages are uploaded
+  // again from the cpu side with the same pixels and without rasterizing,
+  // and retained text lays out again, which builds its vbo again
+  bool checkContextLoss(bool compact) {
+    string name = compact ? "contextLossCompact" : "contextLoss";
+    ofxTrueTypeFontUC font;
+    if (!font.loadFont(font_, 64))
+      return report(name, false, "couldn't load \"" + font_ + "\"");
+    font.setCompactAtlas(compact);
+    ofxTrueTypeFontUC::Impl *impl = font.mImpl;
+
+    // every character of the font up to U+0800, a few pages at this size
+    basic_string<unsigned int> codes;
+    for (unsigned int c = 0x21; c < 0x800; ++c) {
+      if (FT_Get_Char_Index(impl->face_, c) != 0)
+        codes += c;
+    }
+    ofxTrueTypeFontUC::MutableText text(font);
+    text.setText(convFromUTF32(codes));
+    text.draw(0, 0);
+    vector<ofPixels> before = readAtlas(impl);
+    uint64_t rasterizations = font.getStats().rasterizations;
+    unsigned int generation = impl->generation_;
+
+    font.unloadTextures();
+    font.reloadTextures();
+    text.draw(0, 0);
+    vector<ofPixels> after = readAtlas(impl);
+
+    int differing = 0;
+    for (int i = 0; i < (int)min(before.size(), after.size()); ++i) {
+      if (before[i].size() != after[i].size() ||
+          memcmp(before[i].getData(), after[i].getData(), before[i].size()) != 0)
+        differing++;
+    }
+    uint64_t rasterized = font.getStats().rasterizations - rasterizations;
+    bool ok = before.size() > 1 && after.size() == before.size() && differing == 0 &&
+              rasterized == 0 && impl->generation_ != generation;
+    return report(name, ok, ofToString(after.size()) + " pages, " + ofToString(differing) + " differing, " +
+                  ofToString(rasterized) + " glyphs rasterized again, retained text " +
+                  (impl->generation_ != generation ? "laid out again" : "not laid out again"));
+  }
+
+  // counts the covered pixels of the fbo, and those that aren't of color
+  static void countTint(ofFbo &fbo, const ofColor &color, int &covered, int &wrong) {
+    ofPixels pixels;
+    fbo.readToPixels(pixels);
+    covered = 0;
+    wrong = 0;
+    for (int y = 0; y < (int)pixels.getHeight(); ++y) {
+      for (int x = 0; x < (int)pixels.getWidth(); ++x) {
+        ofColor c = pixels.getColor(x, y);
+        if (c.a < 200)
+          continue;
+        covered++;
+        if (abs(c.r - color.r) > 50 || abs(c.g - color.g) > 50 || abs(c.b - color.b) > 50)
+          wrong++;
+      }
+    }
+  }
+
+  // text takes the color of ofSetColor(), unless it brings its own, on
+  // every path that draws with the text shader of the programmable renderer
+  bool checkTint() {
+    ofxTrueTypeFontUC font;
+    if (!font.loadFont(font_, 24))
+      return report("tint", false, "couldn't load \"" + font_ + "\"");
+    ofxTrueTypeFontUC::MutableText text(font);
+    text.setText("MutableText");
+    ofxTrueTypeFontUC::Console console(font, 10);
+    console.addLine("Console");
+    vector<ofxTrueTypeFontUC::TextItem> items;
+    items.push_back(ofxTrueTypeFontUC::TextItem("drawStrings", 4, 30, ofFloatColor(0, 1, 0)));
+
+    ofFbo fbo;
+    fbo.allocate(256, 64, GL_RGBA);
+    bool ok = true;
+    string detail = useTextShaderUC() ? "text shader" : "fixed pipeline";
+    for (int i = 0; i < 4; ++i) {
+      fbo.begin();
+      ofClear(0, 0, 0, 0);
+      ofSetColor(255, 0, 0);
+      const char *name;
+      ofColor expected(255, 0, 0);
+      if (i == 0) {
+        name = "drawString";
+        font.drawString("drawString", 4, 30);
+      } else if (i == 1) {
+        name = "MutableText";
+        text.draw(4, 30);
+      } else if (i == 2) {
+        name = "Console";
+        console.draw(4, 30, 1);
+      } else {
+        name = "drawStrings";
+        expected = ofColor(0, 255, 0);
+        font.drawStrings(items);
+      }
+      fbo.end();
+      ofSetColor(255);
+
+      int covered, wrong;
+      countTint(fbo, expected, covered, wrong);
+      ok = ok && covered > 0 && wrong == 0;
+      detail += string(", ") + name + " " + ofToString(wrong) + " of " + ofToString(covered) + " pixels off";
+    }
+    return report("tint", ok, detail);
+  }
+
+};
+
+//========================================================================
+int main(int argc, char *argv[]) {
+  ofSetLogLevel(OF_LOG_WARNING);
+  bool check = argc > 1 && string(argv[1]) == "--check";
+  if (check) {
+    argc--;
+    argv++;
+    ofSetLogLevel(OF_LOG_NOTICE);
+    ofGLWindowSettings settings;
+    settings.setGLVersion(3, 2);
+    settings.width = 64;
+    settings.height = 64;
+    ofCreateWindow(settings);
+  }
+  string font = argc > 1 ? argv[1] : OF_TTFUC_SANS;
+  string cjkFont = argc > 2 ? argv[2] : font;
+
+  ofxTrueTypeFontUCBenchmark benchmark(font, cjkFont);
+  if (check)
+    return benchmark.check() ? 0 : 1;
+  benchmark.run();
+  return 0;
+}
@@ -8,6 +8,8 @@
 #include FT_GLYPH_H
 #include FT_OUTLINE_H
 #include FT_TRIGONOMETRY_H
+#include FT_STROKER_H
+#include FT_ADVANCES_H
 #include <fontconfig/fontconfig.h>
 #else
 #if (OF_VERSION_MAJOR == 0) && (OF_VERSION_MINOR <= 8)
@@ -15,32 +17,73 @@
 #include "freetype2/freetype/ftglyph.h"
 #include "freetype2/freetype/ftoutln.h"
 #include "freetype2/freetype/fttrigon.h"
+#include "freetype2/freetype/ftstroke.h"
+#include "freetype2/freetype/ftadvanc.h"
 #else
 #include "freetype.h"
 #include "ftglyph.h"
 #include "ftoutln.h"
 #include "fttrigon.h"
+#include "ftstroke.h"
+#include "ftadvanc.h"
 #endif
 #endif
 
 #include <algorithm>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#include <list>
+
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+#include <hb.h>
+#include <hb-ft.h>
+#endif
 
 #ifdef TARGET_WIN32
 #include <windows.h>
-#include <codecvt>
-#include <locale>
 #endif
 
 #include "ofPoint.h"
 #include "ofConstants.h"
 #include "ofTexture.h"
 #include "ofMesh.h"
+#include "ofVbo.h"
 #include "ofUtils.h"
 #include "ofGraphics.h"
+#include "ofShader.h"
 
 
 
 //===========================================================
+// convert UTF-16 -> UTF-32 (UCS-4), C is char16_t, or wchar_t on windows.
+// unpaired surrogates are kept as they are
+template<class C> static basic_string<unsigned int> convUTF16ToUTF32(const C *src, size_t size) {
+  basic_string<unsigned int> dst;
+  dst.reserve(size);
+  for (size_t index = 0; index < size; ++index) {
+    unsigned int c = (unsigned short)src[index];
+    if (c >= 0xd800 && c < 0xdc00 && index + 1 < size) {
+      unsigned int low = (unsigned short)src[index+1];
+      if (low >= 0xdc00 && low < 0xe000) {
+        c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+        index++;
+      }
+    }
+    dst += c;
+  }
+  return dst;
+}
+
 #ifdef TARGET_WIN32
 
 static const basic_string<unsigned int> convToUTF32(const string &src) {
@@ -48,19 +91,37 @@ static const basic_string<unsigned int> convToUTF32(const string &src) {
     return basic_string<unsigned int> ();
   }
   
-  // convert XXX -> UTF-16
-  const int n_size = ::MultiByteToWideChar(CP_ACP, 0, src.c_str(), -1, NULL, 0);
-  vector<wchar_t> buffUTF16(n_size);
-  ::MultiByteToWideChar(CP_ACP, 0, src.c_str(), -1, &buffUTF16[0], n_size);
+  // convert XXX -> UTF-16 in one call, a byte of any code page is
+  // at most one UTF-16 unit, then UTF-16 -> UTF-32 while copying it
+  vector<wchar_t> buffUTF16(src.size());
+  const int n_size = ::MultiByteToWideChar(CP_ACP, 0, src.c_str(), (int)src.size(), &buffUTF16[0], (int)buffUTF16.size());
+  return convUTF16ToUTF32(&buffUTF16[0], n_size);
+}
+
+static string convFromUTF32(const basic_string<unsigned int> &src) {
+  if (src.size() == 0) {
+    return string();
+  }
   
-  // convert UTF-16 -> UTF-8
-  const int utf8str_size = ::WideCharToMultiByte(CP_UTF8, 0, &buffUTF16[0], -1, NULL, 0, NULL, 0);
-  vector<char> buffUTF8(utf8str_size);
-  ::WideCharToMultiByte(CP_UTF8, 0, &buffUTF16[0], -1, &buffUTF8[0], utf8str_size, NULL, 0);
+  // convert UTF-32 -> UTF-16
+  vector<wchar_t> buffUTF16;
+  for (size_t i = 0; i < src.size(); ++i) {
+    unsigned int c = src[i];
+    if (c >= 0x10000) {
+      c -= 0x10000;
+      buffUTF16.push_back(0xd800 | (c >> 10));
+      buffUTF16.push_back(0xdc00 | (c & 0x3ff));
+    }
+    else
+      buffUTF16.push_back(c);
+  }
+  buffUTF16.push_back(0);
   
-  // convert UTF-8 -> UTF-32 (UCS-4)
-  std::wstring_convert<std::codecvt_utf8<unsigned int>, unsigned int> convert32;
-  return convert32.from_bytes(&buffUTF8[0]);
+  // convert UTF-16 -> XXX
+  const int n_size = ::WideCharToMultiByte(CP_ACP, 0, &buffUTF16[0], -1, NULL, 0, NULL, 0);
+  vector<char> buff(n_size);
+  ::WideCharToMultiByte(CP_ACP, 0, &buffUTF16[0], -1, &buff[0], n_size, NULL, 0);
+  return string(&buff[0]);
 }
 
 #else
@@ -118,6 +179,35 @@ static const basic_string<unsigned int> convToUTF32(const string &utf8_src){
   return dst;
 }
 
+static string convFromUTF32(const basic_string<unsigned int> &src) {
+  string dst;
+  
+  // convert UTF-32 (UCS-4) -> UTF-8
+  for (size_t i = 0; i < src.size(); ++i) {
+    unsigned int c = src[i];
+    if (c < 0x80) {
+      dst += (char)c;
+    }
+    else if (c < 0x800) {
+      dst += (char)(0xc0 | (c >> 6));
+      dst += (char)(0x80 | (c & 0x3f));
+    }
+    else if (c < 0x10000) {
+      dst += (char)(0xe0 | (c >> 12));
+      dst += (char)(0x80 | ((c >> 6) & 0x3f));
+      dst += (char)(0x80 | (c & 0x3f));
+    }
+    else {
+      dst += (char)(0xf0 | (c >> 18));
+      dst += (char)(0x80 | ((c >> 12) & 0x3f));
+      dst += (char)(0x80 | ((c >> 6) & 0x3f));
+      dst += (char)(0x80 | (c & 0x3f));
+    }
+  }
+  
+  return dst;
+}
+
 #endif
 
 //--------------------------------------------------
@@ -125,22 +215,679 @@ typedef struct {
   int character;
   int height;
   int width;
-  int setWidth;
+  float setWidth;
   int topExtent;
   int leftExtent;
   float tW,tH;
   float x1,x2,y1,y2;
   float t1,t2,v1,v2;
+  int page;
+  bool color;  // RGBA bitmap, like emoji
+  float vertAdvance;  // vertical layout, the advance down the column
+  float vertOriginX, vertOriginY;  // and the horizontal origin from the pen on the column's center line
 } charPropsUC;
 
+//--------------------------------------------------
+typedef struct {
+  ofPixels pixels;  // cpu side copy of the page, luminance alpha or RGBA
+  vector<unsigned char> packed;  // pixels run length encoded instead, see setCompactAtlas()
+  int size, channels;  // of pixels, also while they are packed
+  ofTexture texture;
+  int penX, penY, shelfHeight;
+  int dirtyTop, dirtyBottom;  // rows not uploaded yet
+  int usedPixels;
+  int deadPixels;  // of glyphs no table refers to anymore, like those of cleared effects
+  unsigned int lastUsed;  // draw of the last lookup, for evicting color pages
+} atlasPageUC;
+
+// PackBits over whole pixels: a header n below 128 is followed by n + 1
+// literal pixels, otherwise by one pixel repeated n - 126 times.
+// the empty parts of a page pack into 3 or 5 bytes per 129 pixels
+static void packPixelsUC(const ofPixels &pixels, vector<unsigned char> &packed) {
+  const unsigned char *src = pixels.getData();
+  int c = pixels.getNumChannels();
+  size_t n = pixels.getWidth() * pixels.getHeight();
+  packed.clear();
+  size_t i = 0;
+  while (i < n) {
+    size_t run = 1;
+    while (i + run < n && run < 129 && memcmp(src + (i + run) * c, src + i * c, c) == 0)
+      run++;
+    if (run > 1) {
+      packed.push_back(run + 126);
+      packed.insert(packed.end(), src + i * c, src + (i + 1) * c);
+      i += run;
+      continue;
+    }
+    // literals until the next run
+    size_t start = i;
+    while (i < n && i - start < 128 && !(i + 1 < n && memcmp(src + i * c, src + (i + 1) * c, c) == 0))
+      i++;
+    packed.push_back(i - start - 1);
+    packed.insert(packed.end(), src + start * c, src + i * c);
+  }
+  vector<unsigned char>(packed).swap(packed);
+}
+
+// into pixels already allocated with the size and channels of the packed ones
+static void unpackPixelsUC(const vector<unsigned char> &packed, ofPixels &pixels) {
+  int c = pixels.getNumChannels();
+  unsigned char *dst = pixels.getData();
+  const unsigned char *src = packed.data();
+  const unsigned char *end = src + packed.size();
+  while (src < end) {
+    int n = *src++;
+    if (n < 128) {
+      memcpy(dst, src, (n + 1) * c);
+      dst += (n + 1) * c;
+      src += (n + 1) * c;
+    }
+    else {
+      for (int k = 0; k < n - 126; ++k, dst += c)
+        memcpy(dst, src, c);
+      src += c;
+    }
+  }
+}
+
+//--------------------------------------------------
+typedef struct {
+  int type;
+  float size;  // outline width or blur radius
+  float offsetX, offsetY;
+  ofFloatColor color;
+  vector<charPropsUC> cps;  // baked glyph for each charID
+  vector<ofMesh> quads;  // quads waiting to be drawn, per page
+} effectUC;
+
+//--------------------------------------------------
+typedef struct {
+  string name;
+  string filename;
+  int fontSize;
+  FT_Face face;  // NULL if it couldn't be opened, its glyphs come from the font's face
+  float bitmapScale;
+} fontStyleUC;
+
+//--------------------------------------------------
+struct codesHashUC {
+  size_t operator()(const basic_string<unsigned int> &codes) const {
+    // FNV-1a
+    size_t h = 2166136261u;
+    for (size_t i = 0; i < codes.size(); ++i)
+      h = (h ^ codes[i]) * 16777619u;
+    return h;
+  }
+};
+
+// what was worked out for the last lines of text, the least recently used is dropped
+template<class V> class lineCacheUC {
+public:
+  lineCacheUC(size_t capacity) :capacity_(capacity) {}
+  
+  V * find(const basic_string<unsigned int> &line) {
+    typename indexUC::iterator it = index_.find(line);
+    if (it == index_.end())
+      return NULL;
+    items_.splice(items_.begin(), items_, it->second);
+    return &it->second->second;
+  }
+  V & insert(const basic_string<unsigned int> &line) {
+    items_.push_front(make_pair(line, V()));
+    index_[line] = items_.begin();
+    if (items_.size() > capacity_) {
+      index_.erase(items_.back().first);
+      items_.pop_back();
+    }
+    return items_.front().second;
+  }
+  void clear() {
+    items_.clear();
+    index_.clear();
+  }
+  size_t size() {
+    return items_.size();
+  }
+  
+private:
+  typedef list<pair<basic_string<unsigned int>, V> > itemsUC;  // the most recently used first
+  typedef unordered_map<basic_string<unsigned int>, typename itemsUC::iterator, codesHashUC> indexUC;
+  itemsUC items_;
+  indexUC index_;
+  size_t capacity_;
+};
+
+// a run of characters of one direction, in the order they are displayed
+typedef struct {
+  int begin, end;  // in the line
+  int level;  // odd for right to left
+} bidiRunUC;
+
+// bidirectional classes, the subset of UAX #9 without explicit embeddings
+// and isolates, boundary neutrals are folded into NSM and separators into WS
+enum bidiClassUC {
+  kBidiL,  // left to right letters and everything else
+  kBidiR,  // hebrew and other right to left letters
+  kBidiAL,  // arabic letters
+  kBidiEN,  // european digits
+  kBidiES,  // plus and minus
+  kBidiET,  // currency, percent and degree signs
+  kBidiAN,  // arabic digits
+  kBidiCS,  // separators inside numbers
+  kBidiNSM,  // combining marks
+  kBidiWS,  // whitespace
+  kBidiON,  // other neutrals, punctuation and symbols
+};
+
+static bidiClassUC getBidiClass(unsigned int c) {
+  if (c < 0x80) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+      return kBidiL;
+    if (c >= '0' && c <= '9')
+      return kBidiEN;
+    if (c == ' ' || c == '\t' || c == '\f')
+      return kBidiWS;
+    if (c == '+' || c == '-')
+      return kBidiES;
+    if (c == '#' || c == '$' || c == '%')
+      return kBidiET;
+    if (c == ',' || c == '.' || c == '/' || c == ':')
+      return kBidiCS;
+    return kBidiON;
+  }
+  if (c == 0x200e)  // LRM
+    return kBidiL;
+  if (c == 0x200f)  // RLM
+    return kBidiR;
+  if (c == 0x061c)  // ALM
+    return kBidiAL;
+  if ((c >= 0x0300 && c <= 0x036f) || (c >= 0x0483 && c <= 0x0489) || (c >= 0x0591 && c <= 0x05bd) ||
+      c == 0x05bf || c == 0x05c1 || c == 0x05c2 || c == 0x05c4 || c == 0x05c5 || c == 0x05c7 ||
+      (c >= 0x0610 && c <= 0x061a) || (c >= 0x064b && c <= 0x065f) || c == 0x0670 ||
+      (c >= 0x06d6 && c <= 0x06dc) || (c >= 0x06df && c <= 0x06e4) || c == 0x06e7 || c == 0x06e8 ||
+      (c >= 0x06ea && c <= 0x06ed) || (c >= 0x200b && c <= 0x200d) || (c >= 0x2060 && c <= 0x2064) ||
+      (c >= 0x20d0 && c <= 0x20ff) || c == 0xfb1e || (c >= 0xfe00 && c <= 0xfe0f) ||
+      (c >= 0xfe20 && c <= 0xfe2f) || c == 0xfeff)
+    return kBidiNSM;
+  if ((c >= 0x0660 && c <= 0x0669) || c == 0x066b || c == 0x066c)
+    return kBidiAN;
+  if ((c >= 0x06f0 && c <= 0x06f9) || c == 0x00b2 || c == 0x00b3 || c == 0x00b9 || (c >= 0xff10 && c <= 0xff19))
+    return kBidiEN;
+  if ((c >= 0x00a2 && c <= 0x00a5) || c == 0x00b0 || c == 0x00b1 || c == 0x066a ||
+      (c >= 0x2030 && c <= 0x2034) || (c >= 0x20a0 && c <= 0x20cf))
+    return kBidiET;
+  if (c == 0x00a0 || c == 0x060c || c == 0x202f || c == 0x2044)
+    return kBidiCS;
+  if ((c >= 0x2000 && c <= 0x200a) || c == 0x2028 || c == 0x205f || c == 0x3000)
+    return kBidiWS;
+  if ((c >= 0x0590 && c <= 0x05ff) || (c >= 0x07c0 && c <= 0x085f) || (c >= 0xfb1d && c <= 0xfb4f) ||
+      (c >= 0x10800 && c <= 0x10fff) || (c >= 0x1e800 && c <= 0x1efff))
+    return kBidiR;
+  if ((c >= 0x0600 && c <= 0x07bf) || (c >= 0x0860 && c <= 0x08ff) || (c >= 0xfb50 && c <= 0xfdff) ||
+      (c >= 0xfe70 && c <= 0xfefe))
+    return kBidiAL;
+  if ((c >= 0x00a1 && c <= 0x00bf && c != 0x00aa && c != 0x00b5 && c != 0x00ba) ||
+      (c >= 0x2010 && c <= 0x2027) || (c >= 0x2035 && c <= 0x205e) || (c >= 0x2190 && c <= 0x2bff) ||
+      (c >= 0x3001 && c <= 0x3004) || (c >= 0x3008 && c <= 0x3020) || (c >= 0xfe50 && c <= 0xfe6f) ||
+      (c >= 0x1f000 && c <= 0x1faff))
+    return kBidiON;
+  return kBidiL;
+}
+
+// whether the text has anything that isn't displayed left to right, most
+// text is rejected by the first comparison of every character
+static bool hasRightToLeft(const unsigned int *codes, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (codes[i] < 0x0590)
+      continue;
+    bidiClassUC type = getBidiClass(codes[i]);
+    if (type == kBidiR || type == kBidiAL || type == kBidiAN)
+      return true;
+  }
+  return false;
+}
+
+// the embedding level of every character of a paragraph (rules P2 to I2),
+// and its trailing whitespace (L1). returns the paragraph level
+static int resolveBidiLevels(const unsigned int *codes, int len, vector<unsigned char> &levels) {
+  levels.resize(len);
+  if (len == 0)
+    return 0;
+  
+  // the types are resolved in place, then replaced by the levels
+  unsigned char *t = &levels[0];
+  int paragraph = -1;
+  for (int i = 0; i < len; ++i) {
+    t[i] = getBidiClass(codes[i]);
+    if (paragraph < 0 && (t[i] == kBidiL || t[i] == kBidiR || t[i] == kBidiAL))
+      paragraph = (t[i] == kBidiL) ? 0 : 1;
+  }
+  if (paragraph < 0)
+    paragraph = 0;
+  unsigned char sos = paragraph ? kBidiR : kBidiL;
+  
+  // W1 to W3: marks take the type before them, digits after arabic letters are arabic
+  unsigned char prev = sos;
+  unsigned char strong = sos;
+  for (int i = 0; i < len; ++i) {
+    if (t[i] == kBidiNSM)
+      t[i] = prev;
+    prev = t[i];
+    if (t[i] == kBidiL || t[i] == kBidiR || t[i] == kBidiAL)
+      strong = t[i];
+    else if (t[i] == kBidiEN && strong == kBidiAL)
+      t[i] = kBidiAN;
+  }
+  for (int i = 0; i < len; ++i) {
+    if (t[i] == kBidiAL)
+      t[i] = kBidiR;
+  }
+  // W4: a single separator between two numbers of the same type joins them
+  for (int i = 1; i + 1 < len; ++i) {
+    if (t[i] == kBidiES && t[i-1] == kBidiEN && t[i+1] == kBidiEN)
+      t[i] = kBidiEN;
+    else if (t[i] == kBidiCS && (t[i-1] == kBidiEN || t[i-1] == kBidiAN) && t[i+1] == t[i-1])
+      t[i] = t[i-1];
+  }
+  // W5: terminators next to european numbers are part of them
+  for (int i = 0; i < len; ) {
+    if (t[i] != kBidiET) {
+      ++i;
+      continue;
+    }
+    int j = i;
+    while (j < len && t[j] == kBidiET)
+      ++j;
+    if ((i > 0 && t[i-1] == kBidiEN) || (j < len && t[j] == kBidiEN))
+      fill(t + i, t + j, (unsigned char)kBidiEN);
+    i = j;
+  }
+  // W6, W7: other separators are neutral, european numbers after left to right text are left to right
+  strong = sos;
+  for (int i = 0; i < len; ++i) {
+    if (t[i] == kBidiES || t[i] == kBidiET || t[i] == kBidiCS)
+      t[i] = kBidiON;
+    else if (t[i] == kBidiL || t[i] == kBidiR)
+      strong = t[i];
+    else if (t[i] == kBidiEN && strong == kBidiL)
+      t[i] = kBidiL;
+  }
+  // N1, N2: neutrals between text of one direction take it, numbers count as right to left
+  for (int i = 0; i < len; ) {
+    if (t[i] != kBidiWS && t[i] != kBidiON) {
+      ++i;
+      continue;
+    }
+    int j = i;
+    while (j < len && (t[j] == kBidiWS || t[j] == kBidiON))
+      ++j;
+    int before = (i > 0) ? (t[i-1] != kBidiL) : paragraph;
+    int after = (j < len) ? (t[j] != kBidiL) : paragraph;
+    int direction = (before == after) ? before : paragraph;
+    fill(t + i, t + j, (unsigned char)(direction ? kBidiR : kBidiL));
+    i = j;
+  }
+  // I1, I2
+  for (int i = 0; i < len; ++i) {
+    if (paragraph == 0)
+      t[i] = (t[i] == kBidiL) ? 0 : (t[i] == kBidiR) ? 1 : 2;
+    else
+      t[i] = (t[i] == kBidiR) ? 1 : 2;
+  }
+  // L1: whitespace at the end of the paragraph is back to its level
+  for (int i = len; i > 0 && getBidiClass(codes[i-1]) == kBidiWS; --i)
+    t[i-1] = paragraph;
+  return paragraph;
+}
+
+// the runs of a line of resolved levels in display order (rule L2)
+static void reorderBidiRuns(const unsigned char *levels, int len, vector<bidiRunUC> &runs) {
+  runs.clear();
+  int highest = 0;
+  int lowestOdd = INT_MAX;
+  for (int i = 0; i < len; ) {
+    int j = i + 1;
+    while (j < len && levels[j] == levels[i])
+      ++j;
+    bidiRunUC run = {i, j, levels[i]};
+    runs.push_back(run);
+    highest = max(highest, run.level);
+    if (run.level & 1)
+      lowestOdd = min(lowestOdd, run.level);
+    i = j;
+  }
+  // from the highest level down, every sequence of runs at that level or above is reversed
+  for (int level = highest; level >= lowestOdd; --level) {
+    for (size_t r = 0; r < runs.size(); ) {
+      if (runs[r].level < level) {
+        ++r;
+        continue;
+      }
+      size_t s = r;
+      while (s < runs.size() && runs[s].level >= level)
+        ++s;
+      reverse(runs.begin() + r, runs.begin() + s);
+      r = s;
+    }
+  }
+}
+
+// brackets and other paired characters are mirrored in right to left runs
+static unsigned int getBidiMirror(unsigned int c) {
+  static const unsigned int pairs[] = {
+    '(', ')', '<', '>', '[', ']', '{', '}', 0x00ab, 0x00bb, 0x2039, 0x203a, 0x2045, 0x2046,
+    0x2264, 0x2265, 0x3008, 0x3009, 0x300a, 0x300b, 0x300c, 0x300d, 0x300e, 0x300f, 0x3010, 0x3011,
+    0xff08, 0xff09, 0xff1c, 0xff1e, 0xff3b, 0xff3d, 0xff5b, 0xff5d,
+  };
+  for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); ++i) {
+    if (pairs[i] == c)
+      return pairs[i ^ 1];
+  }
+  return c;
+}
+
+// whether a character stays upright in vertical text, a subset of UAX #50,
+// the others are turned clockwise with the runs they are in
+static bool isUpright(unsigned int c) {
+  return (c >= 0x1100 && c <= 0x11ff) ||  // hangul jamo
+         (c >= 0x2e80 && c <= 0xa4cf) ||  // CJK radicals, punctuation, kana, ideographs, yi
+         (c >= 0xac00 && c <= 0xd7af) ||  // hangul
+         (c >= 0xf900 && c <= 0xfaff) ||  // compatibility ideographs
+         (c >= 0xfe10 && c <= 0xfe1f) || (c >= 0xfe30 && c <= 0xfe4f) ||  // vertical forms
+         (c >= 0xff00 && c <= 0xffef) ||  // fullwidth and halfwidth forms
+         (c >= 0x1f000 && c <= 0x1faff) ||  // emoji
+         (c >= 0x20000 && c <= 0x3fffd);  // ideographs extensions
+}
+
+// the presentation form of punctuation for vertical text, what the vert
+// feature substitutes in fonts that have it
+static unsigned int getVerticalForm(unsigned int c) {
+  // sorted by character
+  static const unsigned int forms[][2] = {
+    {0x2014, 0xfe31}, {0x2025, 0xfe30}, {0x2026, 0xfe19}, {0x3001, 0xfe11}, {0x3002, 0xfe12},
+    {0x3008, 0xfe3f}, {0x3009, 0xfe40}, {0x300a, 0xfe3d}, {0x300b, 0xfe3e}, {0x300c, 0xfe41},
+    {0x300d, 0xfe42}, {0x300e, 0xfe43}, {0x300f, 0xfe44}, {0x3010, 0xfe3b}, {0x3011, 0xfe3c},
+    {0x3014, 0xfe39}, {0x3015, 0xfe3a}, {0x3016, 0xfe17}, {0x3017, 0xfe18}, {0xff01, 0xfe15},
+    {0xff08, 0xfe35}, {0xff09, 0xfe36}, {0xff0c, 0xfe10}, {0xff1a, 0xfe13}, {0xff1b, 0xfe14},
+    {0xff1f, 0xfe16}, {0xff3b, 0xfe47}, {0xff3d, 0xfe48}, {0xff3f, 0xfe33}, {0xff5b, 0xfe37},
+    {0xff5d, 0xfe38},
+  };
+  static const int count = sizeof(forms) / sizeof(forms[0]);
+  if (c < forms[0][0] || c > forms[count - 1][0])
+    return c;
+  int lo = 0;
+  int hi = count - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (forms[mid][0] == c)
+      return forms[mid][1];
+    if (forms[mid][0] < c)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return c;
+}
+
+// turns a glyph quad laid out at 0, 0 clockwise, and moves it to x, y
+static void turnQuad(ofVec3f *vertices, float x, float y) {
+  for (int i = 0; i < 4; ++i)
+    vertices[i].set(x - vertices[i].y, y + vertices[i].x, 0);
+}
+
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+//--------------------------------------------------
+typedef struct {
+  unsigned int index;  // glyph in the face
+  unsigned int cluster;  // character of the run it was shaped from
+  float advance;
+  float offsetX, offsetY;
+} shapedGlyphUC;
+#endif
+
+//--------------------------------------------------
+// tracing of loading, rasterization, upload and drawing.
+// compiled in only with OFX_TRUETYPEFONTUC_TRACING defined,
+// otherwise the TTFUC_TRACE macros expand to nothing
+#ifdef OFX_TRUETYPEFONTUC_TRACING
+
+typedef struct {
+  atomic<uint64_t> sequence;  // index of the event + 1 once written, 0 while writing
+  const char *name;
+  uint64_t start;
+  uint64_t duration;
+  uint32_t thread;
+} traceEventUC;
+
+static const size_t kTraceCapacity = 1 << 16;  // power of two
+static traceEventUC traceEvents_[kTraceCapacity];
+static atomic<uint64_t> traceHead_(0);
+static atomic<bool> traceEnabled_(false);
+
+static uint64_t traceMicros() {
+  return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t traceThreadID() {
+  static atomic<uint32_t> nextID(1);
+  static thread_local uint32_t id = nextID.fetch_add(1, memory_order_relaxed);
+  return id;
+}
+
+// lock free, writers overwrite the oldest events when the ring is full
+static void recordTraceEvent(const char *name, uint64_t start, uint64_t end) {
+  uint64_t index = traceHead_.fetch_add(1, memory_order_relaxed);
+  traceEventUC &event = traceEvents_[index & (kTraceCapacity - 1)];
+  event.sequence.store(0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  event.name = name;
+  event.start = start;
+  event.duration = end - start;
+  event.thread = traceThreadID();
+  event.sequence.store(index + 1, memory_order_release);
+}
+
+class traceScopeUC {
+public:
+  traceScopeUC(const char *name) :name_(name), start_(0) {
+    if (traceEnabled_.load(memory_order_relaxed))
+      start_ = traceMicros();
+  }
+  ~traceScopeUC() {
+    if (start_)
+      recordTraceEvent(name_, start_, traceMicros());
+  }
+  // end this event and start the next phase
+  void next(const char *name) {
+    if (start_) {
+      uint64_t now = traceMicros();
+      recordTraceEvent(name_, start_, now);
+      start_ = now;
+    }
+    name_ = name;
+  }
+private:
+  const char *name_;
+  uint64_t start_;
+};
+
+#define TTFUC_TRACE(scope, name) traceScopeUC scope(name)
+#define TTFUC_TRACE_NEXT(scope, name) scope.next(name)
+
+#else
+
+#define TTFUC_TRACE(scope, name)
+#define TTFUC_TRACE_NEXT(scope, name)
+
+#endif
+
+//--------------------------------------------------
+void ofxTrueTypeFontUC::setTracingEnabled(bool enabled) {
+#ifdef OFX_TRUETYPEFONTUC_TRACING
+  traceEnabled_.store(enabled, memory_order_relaxed);
+#else
+  if (enabled)
+    ofLogWarning("ofxTrueTypeFontUC") << "setTracingEnabled(): build with OFX_TRUETYPEFONTUC_TRACING to trace";
+#endif
+}
+
+bool ofxTrueTypeFontUC::isTracingEnabled() {
+#ifdef OFX_TRUETYPEFONTUC_TRACING
+  return traceEnabled_.load(memory_order_relaxed);
+#else
+  return false;
+#endif
+}
+
+void ofxTrueTypeFontUC::clearTrace() {
+#ifdef OFX_TRUETYPEFONTUC_TRACING
+  for (size_t i = 0; i < kTraceCapacity; ++i)
+    traceEvents_[i].sequence.store(0, memory_order_relaxed);
+#endif
+}
+
+string ofxTrueTypeFontUC::getTraceJSON() {
+  ostringstream json;
+  json << "{\"traceEvents\":[";
+#ifdef OFX_TRUETYPEFONTUC_TRACING
+  // copy the events that aren't being written, then sort them by time
+  vector<pair<uint64_t, size_t> > order;
+  vector<const char *> names;
+  vector<uint64_t> starts, durations;
+  vector<uint32_t> threads;
+  for (size_t i = 0; i < kTraceCapacity; ++i) {
+    traceEventUC &event = traceEvents_[i];
+    uint64_t sequence = event.sequence.load(memory_order_acquire);
+    if (sequence == 0)
+      continue;
+    const char *name = event.name;
+    uint64_t start = event.start;
+    uint64_t duration = event.duration;
+    uint32_t thread = event.thread;
+    atomic_thread_fence(memory_order_acquire);
+    if (event.sequence.load(memory_order_relaxed) != sequence)
+      continue;
+    order.push_back(make_pair(start, names.size()));
+    names.push_back(name);
+    starts.push_back(start);
+    durations.push_back(duration);
+    threads.push_back(thread);
+  }
+  sort(order.begin(), order.end());
+  for (size_t i = 0; i < order.size(); ++i) {
+    size_t k = order[i].second;
+    json << (i ? ",\n" : "\n") << "{\"name\":\"" << names[k] << "\",\"cat\":\"ofxTrueTypeFontUC\",\"ph\":\"X\""
+         << ",\"ts\":" << starts[k] << ",\"dur\":" << durations[k] << ",\"pid\":1,\"tid\":" << threads[k] << "}";
+  }
+#endif
+  json << "]}";
+  return json.str();
+}
+
+//--------------------------------------------------
+// threads of parallelFor(), started on first use and kept until exit,
+// so that a batch only costs waking them up
+class workerPoolUC {
+public:
+  static workerPoolUC & get() {
+    static workerPoolUC pool;
+    return pool;
+  }
+  
+  // runs fn(0) to fn(tasks - 1), the calling thread takes tasks too
+  void run(int tasks, const function<void(int)> &fn) {
+    lock_guard<mutex> running(runLock_);
+    unique_lock<mutex> lock(lock_);
+    fn_ = &fn;
+    tasks_ = tasks;
+    next_ = 0;
+    pending_ = tasks;
+    wake_.notify_all();
+    while (next_ < tasks_) {
+      int task = next_++;
+      lock.unlock();
+      fn(task);
+      lock.lock();
+      pending_--;
+    }
+    done_.wait(lock, [this] { return pending_ == 0; });
+    fn_ = NULL;
+  }
+  
+private:
+  workerPoolUC() :fn_(NULL), tasks_(0), next_(0), pending_(0), quit_(false) {
+    int threads = max((int)thread::hardware_concurrency(), 1);
+    for (int i = 1; i < threads; ++i)
+      workers_.push_back(thread(&workerPoolUC::work, this));
+  }
+  
+  ~workerPoolUC() {
+    {
+      lock_guard<mutex> lock(lock_);
+      quit_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < workers_.size(); ++i)
+      workers_[i].join();
+  }
+  
+  void work() {
+    unique_lock<mutex> lock(lock_);
+    while (true) {
+      wake_.wait(lock, [this] { return quit_ || (fn_ != NULL && next_ < tasks_); });
+      if (quit_)
+        return;
+      int task = next_++;
+      const function<void(int)> &fn = *fn_;
+      lock.unlock();
+      fn(task);
+      lock.lock();
+      if (--pending_ == 0)
+        done_.notify_all();
+    }
+  }
+  
+  mutex runLock_;  // one batch at a time
+  mutex lock_;
+  condition_variable wake_;
+  condition_variable done_;
+  vector<thread> workers_;
+  const function<void(int)> *fn_;
+  int tasks_;
+  int next_;
+  int pending_;  // tasks not finished
+  bool quit_;
+};
+
+// run fn over [0, n) in contiguous chunks on the worker pool
+static void parallelFor(size_t n, size_t grain, const function<void(size_t, size_t)> &fn) {
+  size_t threads = thread::hardware_concurrency();
+  if (grain == 0)
+    grain = 1;
+  threads = min(threads, (n + grain - 1) / grain);
+  if (threads < 2) {
+    fn(0, n);
+    return;
+  }
+  
+  size_t chunk = (n + threads - 1) / threads;
+  workerPoolUC::get().run((n + chunk - 1) / chunk, [&](int task) {
+    fn(task * chunk, min(n, (task + 1) * chunk));
+  });
+}
+
 
 //---------------------------------------------------
 class ofxTrueTypeFontUC::Impl {
 public:
-  Impl() :librariesInitialized_(false){};
+  Impl();
   ~Impl() {};
   
   bool implLoadFont(string filename, int fontsize, bool _bAntiAliased, bool makeContours, float _simplifyAmt, int dpi);
+  shared_ptr<AsyncLoad::State> asyncLoad_;  // pending loadAsync()
+  void cancelAsyncLoad();
+  static void runAsyncLoad(shared_ptr<AsyncLoad::State> state, string filename, int fontsize,
+                           bool bAntiAliased, bool makeContours, float simplifyAmt, int dpi, basic_string<unsigned int> preload);
   void implReserveCharacters(int num);
   void implUnloadFont();
   
@@ -161,51 +908,390 @@ public:
   int	fontSize_;
   bool bMakeContours_;
   
-  void drawChar(int c, float x, float y);
+  void drawChar(int c, float x, float y, bool turned=false);
   void drawCharAsShape(int c, float x, float y);
+  void getGlyphQuad(int c, float x, float y, ofVec3f *vertices, ofVec2f *texCoords);
+  static void getGlyphQuad(const charPropsUC &cp, float x, float y, ofVec3f *vertices, ofVec2f *texCoords);
+  void addStringQuads(const basic_string<unsigned int> &utf32_src, float x, float y,
+                      ofAlignHorz horz=OF_ALIGN_HORZ_LEFT, ofAlignVert vert=OF_ALIGN_VERT_IGNORE);
+  void markQuads(vector<int> &starts);
+  void shiftQuads(const vector<int> &starts, float dx, float dy);
+  vector<int> alignLineStarts;  // scratch of addStringQuads()
+  vector<int> alignBlockStarts;
+  void drawPageQuads();
+  void drawQuads(ofMesh &quads, int page);
+  void implDrawStrings(const TextItem *items, size_t count);
+  void layoutStrings(const TextItem *items, size_t count);
+  vector<ofPath> implGetStringAsPoints(const basic_string<unsigned int> &utf32_src, bool vflip);
+  ofRectangle implGetStringBoundingBox(const basic_string<unsigned int> &utf32_src, float x, float y);
   
   int	border_;  // visibleBorder;
   string filename_;
   
-  // ofTexture texAtlas;
-  vector<ofTexture> textures;
+  // glyphs are packed into shelves of a few large textures
+  vector<atlasPageUC> atlasPages;
+  vector<ofMesh> pageQuads;  // quads waiting to be drawn, per page
   bool binded_;
-  ofMesh stringQuads;
+  // state set by bind(), so that each batch changes it once
+  ofBlendMode blendMode_;  // of the app, restored by unbind()
+  GLuint boundTexture_;
+  ofShader *shader_;  // begun by bind()
+  bool vertexColors_;  // of the quads drawn with shader_
+  
+  bool allocateAtlasRect(int w, int h, int channels, int &page, int &x, int &y);
+  int evictColorPage();
+  void packGlyph(charPropsUC &cp, const ofPixels &pixels);
+  void uploadDirtyPages();
+  void compactPages();
+  bool compactAtlas_;
+  ofPixels unpackedPage_;  // scratch of uploadDirtyPages()
+  
+  // sparse pages are emptied a few glyphs per frame, see setAtlasDefragmentation().
+  // the glyph tables are cps, then phaseCps, then the cps of effects_
+  int getNumGlyphTables();
+  charPropsUC & getTableGlyph(int table, int index);
+  void dropGlyphs(const vector<charPropsUC> &glyphs);
+  bool startDefragment();
+  void moveGlyph(int k);
+  void commitDefragment();
+  void cancelDefragment();
+  void defragmentStep();
+  float defragOccupancy_;  // 0 off
+  float defragMillis_;
+  int defragSource_;  // page being emptied, -1 none
+  vector<pair<int, int> > defragGlyphs_;  // table and index of its glyphs
+  vector<charPropsUC> defragMoved_;  // their copies, swapped in when all are moved
+  size_t defragNext_;
+  uint64_t defragFrame_;
+  uint64_t defragFrameMicros_;  // spent in defragFrame_
+  atomic<uint64_t> statDefragPages_;
+  atomic<uint64_t> statDefragGlyphs_;
+  atomic<uint64_t> statDefragMicros_;
+  
+  // scratch buffers of drawStrings(), kept to reuse their capacity
+  vector<basic_string<unsigned int> > batchTexts;
+  vector<int> batchGlyphs;
+  vector<size_t> batchStarts;
+  vector<int> batchOffsets;
+  vector<unsigned char> batchPhases;
+  
+  // layers drawn behind the glyphs, their bitmaps share the atlas
+  vector<effectUC> effects_;
+  void addEffect(int type, float size, float offsetX, float offsetY, const ofColor &color);
+  const charPropsUC & getEffectGlyph(int effect, int charID);
+  void loadEffectGlyph(int effect, int charID);
+  // layers 0 to effects_.size() - 1 are the effects, the last one the glyphs
+  const charPropsUC & getLayerGlyph(int layer, int charID, int phase=0) {
+    return layer < (int)effects_.size() ? getEffectGlyph(layer, charID) : getPhaseGlyph(charID, phase);
+  }
+  ofMesh & getLayerQuads(int layer, int page) {
+    return layer < (int)effects_.size() ? effects_[layer].quads[page] : pageQuads[page];
+  }
   
   typedef struct FT_LibraryRec_ * FT_Library;
   typedef struct FT_FaceRec_ * FT_Face;
   FT_Library library_;
   FT_Face face_;
   bool librariesInitialized_;
+  float setFaceSize(FT_Face face, int fontSize);
+  
+  // faces of addStyle(), style s is styles_[s - 1]. their characters and glyph
+  // indices are keyed with the style in the bits from kStyleShift
+  vector<fontStyleUC> styles_;
+  bool openStyle(fontStyleUC &style);
+  int getStyleKey(int style, unsigned int c) {
+    return c | (style << kStyleShift);
+  }
+  int getStyleOf(int charID) {
+    return (loadedChars[charID] >> kStyleShift) & (kMaxStyles - 1);
+  }
+  FT_Face getFace(int charID) {
+    int style = getStyleOf(charID);
+    return (style == 0 || styles_[style - 1].face == NULL) ? face_ : styles_[style - 1].face;
+  }
+  float getBitmapScale(int charID) {
+    int style = getStyleOf(charID);
+    return (style == 0 || styles_[style - 1].face == NULL) ? bitmapScale_ : styles_[style - 1].bitmapScale;
+  }
+  float getStyleLineHeight(int style) {
+    return style == 0 ? lineHeight_ : lineHeight_ * styles_[style - 1].fontSize / fontSize_;
+  }
+  // scratch of layoutSpans(), the characters of all spans and the style of each
+  basic_string<unsigned int> spanCodes_;
+  vector<unsigned char> spanStyles_;
+  vector<int> spanGlyphs_;  // scratch of getSpansBoundingBox()
+  vector<ofPoint> spanPositions_;
   
   bool loadFontFace(string fontname);
   
   ofPath getCharacterAsPointsFromCharID(const int & charID);
   
-  void bind(const int & charID);
-  void unbind(const int & charID);
+  void bind(ofShader *shader=NULL);
+  void unbind();
+  void setVertexColors(bool colors);
   
   int getCharID(const int & c);
-  void loadChar(const int & charID);
+  int getLoadedCharID(const int & c);
+  // loads the glyph of a charID if needed, for handles kept by the caller
+  int useGlyph(int charID);
+  bool isGlyph(int charID) {
+    return charID >= 0 && charID < (int)loadedChars.size();
+  }
+  // loadedChars holds characters, or raw glyph indices offset by kGlyphIndexKey
+  unsigned int getGlyphIndex(int charID) {
+    int c = loadedChars[charID] & ~((kMaxStyles - 1) << kStyleShift);
+    return c >= kGlyphIndexKey ? c - kGlyphIndexKey : FT_Get_Char_Index(getFace(charID), c);
+  }
+  // of glyphs and their effects alike, so that the effects line up with the glyph
+  FT_Int32 getLoadFlags(FT_Face face) {
+    // subpixel positioning needs outlines that aren't snapped horizontally
+    FT_Int32 loadFlags = subpixelPhases_ > 1 ? FT_LOAD_TARGET_LIGHT : FT_LOAD_DEFAULT;
+#ifdef FT_LOAD_COLOR
+    // color bitmaps (CBDT, sbix) and layers (COLR) come as BGRA
+    if (FT_HAS_COLOR(face))
+      loadFlags |= FT_LOAD_COLOR;
+#endif
+    return loadFlags;
+  }
+  void loadChar(const int & charID, int phase=0);
+  void loadColorGlyph(charPropsUC &cp, FT_Face face, float scale);
+  float getSpaceAdvance(int style=0);
+  string truncate(const string &src, float maxWidth, const basic_string<unsigned int> &ellipsis, float ellipsisWidth);
+  float getAdvances(const basic_string<unsigned int> &line, vector<float> &prefix);
+  vector<float> truncateAdvances;  // scratch of truncate()
+  float getAscender();
   vector<int> loadedChars;
   
+  // bumped whenever glyphs or metrics change, so that
+  // retained text knows its quads are out of date
+  unsigned int generation_;
+  
+  // statistics, relaxed atomics since drawStrings() decodes on several threads
+  atomic<uint64_t> statLookups_;
+  atomic<uint64_t> statMisses_;
+  atomic<uint64_t> statRasterizations_;
+  atomic<uint64_t> statRasterizationMicros_;
+  atomic<uint64_t> statDrawCalls_;
+  atomic<uint64_t> statQuads_;
+  atomic<uint64_t> statBytesDecoded_;
+  int residentGlyphs_;
+  size_t outlineBytes_;
+  
+  basic_string<unsigned int> decode(const string &src);
+  basic_string<unsigned int> decode(const u16string &src);
+  basic_string<unsigned int> decode(const u32string &src);
+  void countDraw(int quads);
+  void resetStats();
+  unordered_map<int, int> charIDs;  // character -> charID
+  
+  // walks text laid out from 0, 0 as drawString() draws it, calling fn(charID, x, y, turned)
+  // for each glyph and fn(-1, width, y, false) at the end of each line
+  template<class F> void layoutText(const basic_string<unsigned int> &text, F fn);
+  // the same for spans in several styles
+  template<class F> void layoutSpans(const vector<StyleSpan> &spans, F fn);
+  
+  // lines are columns from right to left, see setVerticalLayout(). fn gets
+  // turned for glyphs that are turned clockwise around x, y
+  bool vertical_;
+  template<class F> void layoutVertical(const basic_string<unsigned int> &text, F fn);
+  int getVerticalCharID(unsigned int c);
+  // from the center line of a column to the baseline of turned glyphs
+  float getTurnedBaseline() {
+    return -(face_->size->metrics.ascender + face_->size->metrics.descender) / 128.f;
+  }
+  
+  // display order of the lines with right to left characters, left to
+  // right lines are a single run without a lookup
+  lineCacheUC<vector<bidiRunUC> > bidiRuns_;
+  vector<bidiRunUC> leftToRightRun_;
+  basic_string<unsigned int> bidiLine_;
+  vector<unsigned char> bidiLevels_;
+  const vector<bidiRunUC> & getBidiRuns(const basic_string<unsigned int> &text, size_t begin, size_t end);
+  
+  // runs shaped by HarfBuzz, with OFX_TRUETYPEFONTUC_HARFBUZZ defined
+  bool shaping_;
+  string shapingFeatures_;
+  atomic<uint64_t> statShapeHits_;
+  atomic<uint64_t> statShapeMisses_;
+  atomic<uint64_t> statShapingMicros_;
+  bool setShapingFeatures(const string &features);
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+  hb_font_t *hbFont_;
+  hb_buffer_t *hbBuffer_;
+  vector<hb_feature_t> hbFeatures_;
+  // keyed by the text of the run, other directions than left to right end
+  // with kGlyphIndexKey plus the direction.
+  // the face, size and features are the ones of this font, the cache is
+  // cleared when they change
+  lineCacheUC<vector<shapedGlyphUC> > shapedRuns_;
+  const vector<shapedGlyphUC> & shapeRun(const basic_string<unsigned int> &text, size_t begin, size_t end, hb_direction_t direction);
+#endif
+  
+  // color glyphs get their own RGBA pages, at most colorPageLimit_ of them
+  int colorPageLimit_;
+  int fillPage_[5];  // by channels, the page glyphs of that kind go to, -1 none yet
+  unsigned int drawCount_;
+  float bitmapScale_;  // from the fixed size bitmaps of the face to fontSize_
+  
+  // glyphs rasterized at fractions of a pixel, loaded when first drawn there
+  int subpixelPhases_;
+  vector<vector<charPropsUC> > phaseCps;  // [phase - 1][charID]
+  const charPropsUC & getPhaseGlyph(int charID, int phase) {
+    if (phase == 0 || cps[charID].color)
+      return cps[charID];
+    if (phaseCps[phase - 1][charID].character == kTypefaceUnloaded)
+      loadChar(charID, phase);
+    return phaseCps[phase - 1][charID];
+  }
+  // whole pixel to draw a glyph at x from, and the phase of the rest
+  float snapToPhase(float x, int &phase) {
+    float q = floor(x * subpixelPhases_ + 0.5f);
+    float ix = floor(q / subpixelPhases_);
+    phase = (int)(q - ix * subpixelPhases_);
+    return ix;
+  }
+  
   static const int kTypefaceUnloaded;
   static const int kDefaultLimitCharactersNum;
+  static const int kAtlasPageSize;
+  static const int kDefaultColorPageLimit;
+  static const int kMaxSubpixelPhases;
+  static const int kEffectOutline;
+  static const int kEffectShadow;
+  static const int kEffectGlow;
+  static const int kGlyphIndexKey;
+  static const int kShapedRunCacheSize;
+  static const int kBidiRunCacheSize;
+  static const int kStyleShift;
+  static const int kMaxStyles;
   
-  void unloadTextures();
+  void implUnloadTextures();
   bool initLibraries();
   void finishLibraries();
-  
-#ifdef TARGET_OPENGLES
-  GLint blend_src, blend_dst_;
-  GLboolean blend_enabled_;
-  GLboolean texture_2d_enabled_;
-#endif
 };
 
 static bool printVectorInfo_ = false;
 static int ttfGlobalDpi_ = 96;
 
+//--------------------------------------------------------
+// the programmable renderers draw with this shader, and keep the coverage
+// pages in GL_RG textures swizzled to luminance alpha, since core profile
+// has no GL_LUMINANCE_ALPHA. quads without colors of their own, like those
+// of drawString() and the retained text, are tinted with the color of the
+// style, which bind() sets as globalColor
+#ifdef TARGET_OPENGLES
+#define TTFUC_GLSL_VERSION "#version 300 es\nprecision mediump float;\n"
+#else
+#define TTFUC_GLSL_VERSION "#version 150\n"
+#endif
+
+static const char *kTextVertexShaderUC = TTFUC_GLSL_VERSION
+  "uniform mat4 modelViewProjectionMatrix;\n"
+  "in vec4 position;\n"
+  "in vec4 color;\n"
+  "in vec2 texcoord;\n"
+  "out vec4 colorVarying;\n"
+  "out vec2 texCoordVarying;\n"
+  "void main() {\n"
+  "  colorVarying = color;\n"
+  "  texCoordVarying = texcoord;\n"
+  "  gl_Position = modelViewProjectionMatrix * position;\n"
+  "}\n";
+
+static const char *kTextFragmentShaderUC = TTFUC_GLSL_VERSION
+  "uniform sampler2D src_tex_unit0;\n"
+  "uniform vec4 globalColor;\n"
+  "uniform int vertexColors;\n"
+  "in vec4 colorVarying;\n"
+  "in vec2 texCoordVarying;\n"
+  "out vec4 fragColor;\n"
+  "void main() {\n"
+  "  vec4 color = vertexColors != 0 ? colorVarying : globalColor;\n"
+  "  fragColor = color * texture(src_tex_unit0, texCoordVarying);\n"
+  "}\n";
+
+// AnimatedText moves every glyph here. position is the corner relative to the
+// center of the glyph, transform is the center plus the offset, the scale and
+// the rotation in radians of the glyph
+static const int kTransformAttributeUC = 4;  // after the default attributes of oF
+static const char *kAnimatedVertexShaderUC = TTFUC_GLSL_VERSION
+  "uniform mat4 modelViewProjectionMatrix;\n"
+  "in vec4 position;\n"
+  "in vec4 color;\n"
+  "in vec2 texcoord;\n"
+  "in vec4 transform;\n"
+  "out vec4 colorVarying;\n"
+  "out vec2 texCoordVarying;\n"
+  "void main() {\n"
+  "  vec2 turn = vec2(cos(transform.w), sin(transform.w)) * transform.z;\n"
+  "  vec2 corner = vec2(position.x * turn.x - position.y * turn.y, position.x * turn.y + position.y * turn.x);\n"
+  "  colorVarying = color;\n"
+  "  texCoordVarying = texcoord;\n"
+  "  gl_Position = modelViewProjectionMatrix * vec4(transform.xy + corner, position.zw);\n"
+  "}\n";
+
+static ofShader textShaderUC;
+static int textShaderStateUC = 0;  // 0 not tried yet, 1 loaded, -1 failed
+
+// whether to use the text shader, it is compiled on first use, when it
+// fails (a GLES 2 context) the renderer's own shader and formats are used
+static bool useTextShaderUC() {
+  if (textShaderStateUC == 0) {
+    textShaderStateUC = -1;
+    if (ofIsGLProgrammableRenderer()) {
+      textShaderUC.setupShaderFromSource(GL_VERTEX_SHADER, kTextVertexShaderUC);
+      textShaderUC.setupShaderFromSource(GL_FRAGMENT_SHADER, kTextFragmentShaderUC);
+      textShaderUC.bindDefaults();
+      if (textShaderUC.linkProgram()) {
+        textShaderUC.begin();
+        textShaderUC.setUniform1i("src_tex_unit0", 0);
+        textShaderUC.end();
+        textShaderStateUC = 1;
+      }
+      else {
+        ofLogWarning("ofxTrueTypeFontUC") << "couldn't link the text shader, drawing with the renderer's shader";
+      }
+    }
+  }
+  return textShaderStateUC == 1;
+}
+
+static ofShader animatedShaderUC;
+static int animatedShaderStateUC = 0;
+
+// the same for AnimatedText, which transforms its glyphs on the cpu without it
+static bool useAnimatedShaderUC() {
+  if (animatedShaderStateUC == 0) {
+    animatedShaderStateUC = -1;
+    if (useTextShaderUC()) {
+      animatedShaderUC.setupShaderFromSource(GL_VERTEX_SHADER, kAnimatedVertexShaderUC);
+      animatedShaderUC.setupShaderFromSource(GL_FRAGMENT_SHADER, kTextFragmentShaderUC);
+      animatedShaderUC.bindDefaults();
+      animatedShaderUC.bindAttribute(kTransformAttributeUC, "transform");
+      if (animatedShaderUC.linkProgram()) {
+        animatedShaderUC.begin();
+        animatedShaderUC.setUniform1i("src_tex_unit0", 0);
+        animatedShaderUC.end();
+        animatedShaderStateUC = 1;
+      }
+      else {
+        ofLogWarning("ofxTrueTypeFontUC") << "couldn't link the animated text shader, transforming glyphs on the cpu";
+      }
+    }
+  }
+  return animatedShaderStateUC == 1;
+}
+
+// compiled again on the next use, for a new context
+static void unloadTextShaderUC() {
+  if (textShaderStateUC == 1)
+    textShaderUC.unload();
+  textShaderStateUC = 0;
+  if (animatedShaderStateUC == 1)
+    animatedShaderUC.unload();
+  animatedShaderStateUC = 0;
+}
+
 //--------------------------------------------------------
 void ofxTrueTypeFontUC::setGlobalDpi(int newDpi){
   ttfGlobalDpi_ = newDpi;
@@ -365,17 +1451,20 @@ static set<ofxTrueTypeFontUC*> & all_fonts(){
   return *all_fonts;
 }
 
+// the glyphs stay loaded on the cpu side, so that a lost context
+// is recovered by uploading them again, without FreeType
 void ofUnloadAllFontTextures(){
   set<ofxTrueTypeFontUC*>::iterator it;
   for (it=all_fonts().begin(); it!=all_fonts().end(); ++it) {
-    (*it)->unloadFont();
+    (*it)->unloadTextures();
   }
+  unloadTextShaderUC();
 }
 
 void ofReloadAllFontTextures(){
   set<ofxTrueTypeFontUC*>::iterator it;
   for (it=all_fonts().begin(); it!=all_fonts().end(); ++it) {
-    (*it)->reloadFont();
+    (*it)->reloadTextures();
   }
 }
 #endif
@@ -519,28 +1608,63 @@ static string linuxFontPathByName(string fontname){
 //------------------------------------------------------------------
 ofxTrueTypeFontUC::ofxTrueTypeFontUC() {
   mImpl = new Impl();
-  mImpl->bLoadedOk_	= false;
-  mImpl->bMakeContours_	= false;
 #if defined(TARGET_ANDROID) || defined(TARGET_OF_IOS)
   all_fonts().insert(this);
 #endif
-  mImpl->letterSpacing_ = 1;
-  mImpl->spaceSize_ = 1;
+}
+
+ofxTrueTypeFontUC::Impl::Impl() :librariesInitialized_(false), bidiRuns_(kBidiRunCacheSize)
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+, shapedRuns_(kShapedRunCacheSize)
+#endif
+{
+  bLoadedOk_ = false;
+  bMakeContours_ = false;
+  letterSpacing_ = 1;
+  spaceSize_ = 1;
   
   // 3 pixel border around the glyph
   // We show 2 pixels of this, so that blending looks good.
   // 1 pixels is hidden because we don't want to see the real edge of the texture
-  mImpl->border_ = 3;
+  border_ = 3;
   
-  mImpl->stringQuads.setMode(OF_PRIMITIVE_TRIANGLES);
-  mImpl->binded_ = false;
+  binded_ = false;
+  compactAtlas_ = false;
+  defragOccupancy_ = 0;
+  defragMillis_ = 0.5;
+  defragSource_ = -1;
+  defragNext_ = 0;
+  defragFrame_ = 0;
+  defragFrameMicros_ = 0;
+  blendMode_ = OF_BLENDMODE_ALPHA;
+  boundTexture_ = 0;
+  shader_ = NULL;
+  vertexColors_ = false;
+  generation_ = 0;
+  resetStats();
+  residentGlyphs_ = 0;
+  outlineBytes_ = 0;
   
-  mImpl->limitCharactersNum_ = mImpl->kDefaultLimitCharactersNum;
+  limitCharactersNum_ = kDefaultLimitCharactersNum;
+  colorPageLimit_ = kDefaultColorPageLimit;
+  fill(fillPage_, fillPage_ + 5, -1);
+  drawCount_ = 0;
+  bitmapScale_ = 1;
+  subpixelPhases_ = 1;
+  vertical_ = false;
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+  shaping_ = true;
+  hbFont_ = NULL;
+  hbBuffer_ = NULL;
+#else
+  shaping_ = false;
+#endif
 }
 
 //------------------------------------------------------------------
 ofxTrueTypeFontUC::~ofxTrueTypeFontUC() {
   
+  mImpl->cancelAsyncLoad();
   if (mImpl->bLoadedOk_)
     unloadFont();
   
@@ -556,11 +1680,36 @@ void ofxTrueTypeFontUC::Impl::implUnloadFont() {
   if(!bLoadedOk_)
     return;
   
+  cancelDefragment();
   cps.clear();
-  textures.clear();
+  generation_++;
+  residentGlyphs_ = 0;
+  outlineBytes_ = 0;
+  atlasPages.clear();
+  fill(fillPage_, fillPage_ + 5, -1);
+  pageQuads.clear();
+  phaseCps.clear();
+  for (int e = 0; e < (int)effects_.size(); ++e) {
+    effects_[e].cps.clear();
+    effects_[e].quads.clear();
+  }
   loadedChars.clear();
+  charIDs.clear();
+  
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+  shapedRuns_.clear();
+  hb_buffer_destroy(hbBuffer_);
+  hb_font_destroy(hbFont_);
+  hbBuffer_ = NULL;
+  hbFont_ = NULL;
+#endif
   
-  // ------------- close the library and typeface
+  // ------------- close the library and typefaces, styles are opened again by the next load
+  for (int s = 0; s < (int)styles_.size(); ++s) {
+    if (styles_[s].face != NULL)
+      FT_Done_Face(styles_[s].face);
+    styles_[s].face = NULL;
+  }
   FT_Done_Face(face_);
   FT_Done_FreeType(library_);
   
@@ -572,6 +1721,7 @@ void ofxTrueTypeFontUC::unloadFont() {
 }
 
 bool ofxTrueTypeFontUC::Impl::loadFontFace(string fontname){
+  TTFUC_TRACE(trace, "loadFontFace");
   filename_ = ofToDataPath(fontname,true);
   ofFile fontFile(filename_, ofFile::Reference);
   int fontID = 0;
@@ -622,26 +1772,246 @@ bool ofxTrueTypeFontUC::Impl::loadFontFace(string fontname){
 }
 
 void ofxTrueTypeFontUC::reloadFont() {
+  // filename_ is resolved already
   mImpl->implLoadFont(mImpl->filename_, mImpl->fontSize_, mImpl->bAntiAliased_, mImpl->bMakeContours_, mImpl->simplifyAmt_, mImpl->dpi_);
 }
 
 //-----------------------------------------------------------
-bool ofxTrueTypeFontUC::load(string filename, int fontsize, bool bAntiAliased, bool makeContours, float simplifyAmt, int dpi) {
-  return loadFont(filename, fontsize, bAntiAliased, makeContours, simplifyAmt, dpi);
+void ofxTrueTypeFontUC::unloadTextures() {
+  mImpl->implUnloadTextures();
 }
 
-bool ofxTrueTypeFontUC::loadFont(string filename, int fontsize, bool bAntiAliased, bool makeContours, float simplifyAmt, int dpi) {
-  return mImpl->implLoadFont(filename, fontsize, bAntiAliased, makeContours, simplifyAmt, dpi);
-  
+void ofxTrueTypeFontUC::Impl::implUnloadTextures() {
+  for (int i = 0; i < (int)atlasPages.size(); ++i)
+    atlasPages[i].texture.clear();
+  // the vbos of retained text went with the context, they are built again on relayout
+  generation_++;
 }
 
-bool ofxTrueTypeFontUC::Impl::implLoadFont(string filename, int fontsize, bool bAntiAliased, bool makeContours, float simplifyAmt, int dpi) {
-  bMakeContours_ = makeContours;
-  
-  //------------------------------------------------
-  if (bLoadedOk_ == true){
-    // we've already been loaded, try to clean up :
-    implUnloadFont();
+void ofxTrueTypeFontUC::reloadTextures() {
+  TTFUC_TRACE(trace, "reloadTextures");
+  // every page without a texture is uploaded whole
+  mImpl->uploadDirtyPages();
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::setCompactAtlas(bool compact) {
+  mImpl->compactAtlas_ = compact;
+  if (compact) {
+    mImpl->compactPages();
+    return;
+  }
+  for (int i = 0; i < (int)mImpl->atlasPages.size(); ++i) {
+    atlasPageUC &pg = mImpl->atlasPages[i];
+    if (pg.packed.empty())
+      continue;
+    pg.pixels.allocate(pg.size, pg.size, pg.channels);
+    unpackPixelsUC(pg.packed, pg.pixels);
+    vector<unsigned char>().swap(pg.packed);
+  }
+}
+
+bool ofxTrueTypeFontUC::isCompactAtlas() {
+  return mImpl->compactAtlas_;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::setAtlasDefragmentation(float minOccupancy, float millisPerFrame) {
+  // fuller pages could move back and forth between the newest pages
+  mImpl->defragOccupancy_ = min(max(minOccupancy, 0.f), 0.5f);
+  mImpl->defragMillis_ = max(millisPerFrame, 0.f);
+  if (mImpl->defragOccupancy_ == 0)
+    mImpl->cancelDefragment();
+}
+
+float ofxTrueTypeFontUC::getAtlasDefragmentation() {
+  return mImpl->defragOccupancy_;
+}
+
+//-----------------------------------------------------------
+bool ofxTrueTypeFontUC::load(string filename, int fontsize, bool bAntiAliased, bool makeContours, float simplifyAmt, int dpi) {
+  return loadFont(filename, fontsize, bAntiAliased, makeContours, simplifyAmt, dpi);
+}
+
+bool ofxTrueTypeFontUC::loadFont(string filename, int fontsize, bool bAntiAliased, bool makeContours, float simplifyAmt, int dpi) {
+  mImpl->cancelAsyncLoad();
+  return mImpl->implLoadFont(ofToDataPath(filename), fontsize, bAntiAliased, makeContours, simplifyAmt, dpi);
+  
+}
+
+//-----------------------------------------------------------
+struct ofxTrueTypeFontUC::AsyncLoad::State {
+  mutex lock;
+  condition_variable done;
+  bool finished;  // by the worker
+  Status status;  // stays PENDING after the worker succeeded, until update()
+  string error;
+  atomic<bool> cancelled;
+  ofxTrueTypeFontUC *font;
+  ofxTrueTypeFontUC::Impl *loaded;  // owned here until update() swaps it in
+};
+
+// the worker never touches GL, its glyphs are uploaded by update()
+void ofxTrueTypeFontUC::Impl::runAsyncLoad(shared_ptr<AsyncLoad::State> state, string filename, int fontsize,
+                                           bool bAntiAliased, bool makeContours, float simplifyAmt, int dpi, basic_string<unsigned int> preload) {
+  TTFUC_TRACE(trace, "loadAsync");
+  Impl *impl = state->loaded;
+  string error;
+  if (!state->cancelled) {
+    if (impl->implLoadFont(filename, fontsize, bAntiAliased, makeContours, simplifyAmt, dpi)) {
+      for (size_t i = 0; i < preload.size() && !state->cancelled; ++i) {
+        if (preload[i] != ' ' && preload[i] != '\n')
+          impl->getLoadedCharID(preload[i]);
+      }
+    }
+    else
+      error = "couldn't load \"" + filename + "\"";
+  }
+  
+  lock_guard<mutex> lock(state->lock);
+  state->finished = true;
+  if (state->cancelled || !error.empty()) {
+    state->status = state->cancelled ? AsyncLoad::CANCELLED : AsyncLoad::FAILED;
+    state->error = error;
+    impl->implUnloadFont();
+    delete impl;
+    state->loaded = NULL;
+  }
+  state->done.notify_all();
+}
+
+ofxTrueTypeFontUC::AsyncLoad ofxTrueTypeFontUC::loadAsync(string filename, int fontsize, bool bAntiAliased, bool makeContours, float simplifyAmt, int dpi, const string &preload) {
+  mImpl->cancelAsyncLoad();
+  
+  // a new font with the settings of this one, so that this one can be drawn meanwhile
+  Impl *impl = new Impl();
+  impl->border_ = mImpl->border_;
+  impl->limitCharactersNum_ = mImpl->limitCharactersNum_;
+  impl->subpixelPhases_ = mImpl->subpixelPhases_;
+  impl->effects_.resize(mImpl->effects_.size());
+  for (int e = 0; e < (int)mImpl->effects_.size(); ++e) {
+    const effectUC &effect = mImpl->effects_[e];
+    impl->effects_[e].type = effect.type;
+    impl->effects_[e].size = effect.size;
+    impl->effects_[e].offsetX = effect.offsetX;
+    impl->effects_[e].offsetY = effect.offsetY;
+    impl->effects_[e].color = effect.color;
+  }
+  // opened again by the worker
+  impl->styles_ = mImpl->styles_;
+  for (int s = 0; s < (int)impl->styles_.size(); ++s)
+    impl->styles_[s].face = NULL;
+  
+  AsyncLoad load;
+  load.mState = make_shared<AsyncLoad::State>();
+  AsyncLoad::State &state = *load.mState;
+  state.finished = false;
+  state.status = AsyncLoad::PENDING;
+  state.cancelled = false;
+  state.font = this;
+  state.loaded = impl;
+  mImpl->asyncLoad_ = load.mState;
+  
+  // paths are resolved here, ofToDataPath() isn't thread safe
+  thread(Impl::runAsyncLoad, load.mState, ofToDataPath(filename), fontsize, bAntiAliased, makeContours, simplifyAmt, dpi,
+         mImpl->decode(preload)).detach();
+  return load;
+}
+
+void ofxTrueTypeFontUC::Impl::cancelAsyncLoad() {
+  if (!asyncLoad_)
+    return;
+  AsyncLoad load;
+  load.mState = asyncLoad_;
+  load.cancel();
+}
+
+//-----------------------------------------------------------
+ofxTrueTypeFontUC::AsyncLoad::AsyncLoad() {
+}
+
+ofxTrueTypeFontUC::AsyncLoad::Status ofxTrueTypeFontUC::AsyncLoad::update() {
+  if (!mState)
+    return FAILED;
+  unique_lock<mutex> lock(mState->lock);
+  if (!mState->finished || mState->status != PENDING)
+    return mState->status;
+  
+  // the worker succeeded, swap the loaded font in. the retained text
+  // reads the font through its Impl and lays out again on a new generation
+  ofxTrueTypeFontUC *font = mState->font;
+  Impl *loaded = mState->loaded;
+  mState->loaded = NULL;
+  mState->font = NULL;
+  mState->status = LOADED;
+  lock.unlock();
+  
+  TTFUC_TRACE(trace, "finishLoadAsync");
+  Impl *old = font->mImpl;
+  loaded->letterSpacing_ = old->letterSpacing_;
+  loaded->spaceSize_ = old->spaceSize_;
+  loaded->colorPageLimit_ = old->colorPageLimit_;
+  loaded->compactAtlas_ = old->compactAtlas_;
+  loaded->defragOccupancy_ = old->defragOccupancy_;
+  loaded->defragMillis_ = old->defragMillis_;
+  loaded->shaping_ = old->shaping_;
+  loaded->vertical_ = old->vertical_;
+  loaded->setShapingFeatures(old->shapingFeatures_);
+  loaded->generation_ = old->generation_ + 1;
+  old->asyncLoad_.reset();
+  if (old->bLoadedOk_)
+    old->implUnloadFont();
+  delete old;
+  font->mImpl = loaded;
+  loaded->uploadDirtyPages();
+  return LOADED;
+}
+
+ofxTrueTypeFontUC::AsyncLoad::Status ofxTrueTypeFontUC::AsyncLoad::wait() {
+  if (!mState)
+    return FAILED;
+  {
+    unique_lock<mutex> lock(mState->lock);
+    mState->done.wait(lock, [this]() { return mState->finished; });
+  }
+  return update();
+}
+
+void ofxTrueTypeFontUC::AsyncLoad::cancel() {
+  if (!mState)
+    return;
+  lock_guard<mutex> lock(mState->lock);
+  if (mState->status != PENDING)
+    return;
+  mState->cancelled = true;
+  mState->status = CANCELLED;
+  if (mState->font != NULL) {
+    mState->font->mImpl->asyncLoad_.reset();
+    mState->font = NULL;
+  }
+  // otherwise the worker deletes it when it is done
+  if (mState->finished && mState->loaded != NULL) {
+    mState->loaded->implUnloadFont();
+    delete mState->loaded;
+    mState->loaded = NULL;
+  }
+}
+
+string ofxTrueTypeFontUC::AsyncLoad::getError() {
+  if (!mState)
+    return "not loading";
+  lock_guard<mutex> lock(mState->lock);
+  return mState->error;
+}
+
+bool ofxTrueTypeFontUC::Impl::implLoadFont(string filename, int fontsize, bool bAntiAliased, bool makeContours, float simplifyAmt, int dpi) {
+  TTFUC_TRACE(trace, "implLoadFont");
+  bMakeContours_ = makeContours;
+  
+  //------------------------------------------------
+  if (bLoadedOk_ == true){
+    // we've already been loaded, try to clean up :
+    implUnloadFont();
   }
   //------------------------------------------------
   
@@ -650,7 +2020,9 @@ bool ofxTrueTypeFontUC::Impl::implLoadFont(string filename, int fontsize, bool b
     dpi_ = ttfGlobalDpi_;
   }
   
-  filename_ = ofToDataPath(filename);
+  // resolved by the caller, ofToDataPath() isn't thread safe and
+  // loadAsync() loads on a worker
+  filename_ = filename;
   
   bLoadedOk_ = false;
   bAntiAliased_ = bAntiAliased;
@@ -670,10 +2042,11 @@ bool ofxTrueTypeFontUC::Impl::implLoadFont(string filename, int fontsize, bool b
     if (err == 1)
       errorString = "INVALID FILENAME";
     ofLog(OF_LOG_ERROR,"ofxTrueTypeFontUC::loadFont - %s: %s: FT_Error = %d", errorString.c_str(), filename_.c_str(), err);
+    FT_Done_FreeType(library_);
     return false;
   }
   
-  FT_Set_Char_Size(face_, fontSize_ << 6, fontSize_ << 6, dpi_, dpi_);
+  bitmapScale_ = setFaceSize(face_, fontSize_);
   lineHeight_ = fontSize_ * 1.43f;
   
   //------------------------------------------------------
@@ -681,12 +2054,190 @@ bool ofxTrueTypeFontUC::Impl::implLoadFont(string filename, int fontsize, bool b
   //ofLog(OF_LOG_NOTICE,"FT_HAS_KERNING ? %i", FT_HAS_KERNING(face));
   //------------------------------------------------------
   
+  for (int s = 0; s < (int)styles_.size(); ++s)
+    openStyle(styles_[s]);
   implReserveCharacters(limitCharactersNum_);
   
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+  // positions in 26.6 pixels, from the size set above
+  hbFont_ = hb_ft_font_create_referenced(face_);
+  hbBuffer_ = hb_buffer_create();
+  shapedRuns_.clear();
+#endif
+  
   bLoadedOk_ = true;
   return true;
 }
 
+// returns the scale of the glyphs of a face that has no outlines
+float ofxTrueTypeFontUC::Impl::setFaceSize(FT_Face face, int fontSize) {
+  if (FT_IS_SCALABLE(face) || face->num_fixed_sizes == 0) {
+    FT_Set_Char_Size(face, fontSize << 6, fontSize << 6, dpi_, dpi_);
+    return 1;
+  }
+  // bitmap fonts, like most color emoji fonts, only come in a few sizes,
+  // pick the smallest one not smaller than fontSize and scale its glyphs on load
+  float pixelSize = fontSize * dpi_ / 72.f;
+  int best = 0;
+  for (int i = 1; i < face->num_fixed_sizes; ++i) {
+    float size = face->available_sizes[i].y_ppem / 64.f;
+    float bestSize = face->available_sizes[best].y_ppem / 64.f;
+    if ((bestSize < pixelSize && size > bestSize) || (size >= pixelSize && size < bestSize))
+      best = i;
+  }
+  FT_Select_Size(face, best);
+  return pixelSize / (face->available_sizes[best].y_ppem / 64.f);
+}
+
+// style.filename is resolved by addStyle(), this runs on the worker of loadAsync() too
+bool ofxTrueTypeFontUC::Impl::openStyle(fontStyleUC &style) {
+  FT_Error err = FT_New_Face(library_, style.filename.c_str(), 0, &style.face);
+  if (err) {
+    ofLogError("ofxTrueTypeFontUC") << "addStyle(): couldn't load \"" << style.filename << "\": FT_Error = " << err;
+    style.face = NULL;
+    return false;
+  }
+  style.bitmapScale = setFaceSize(style.face, style.fontSize);
+  return true;
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::addStyle(const string &name, string filename, int fontsize) {
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "addStyle(): font not allocated";
+    return -1;
+  }
+  if ((int)mImpl->styles_.size() + 1 >= Impl::kMaxStyles) {
+    ofLogError("ofxTrueTypeFontUC") << "addStyle(): too many styles";
+    return -1;
+  }
+  
+  fontStyleUC style;
+  style.name = name;
+  style.filename = ofToDataPath(filename);
+  style.fontSize = fontsize;
+  if (!mImpl->openStyle(style))
+    return -1;
+  mImpl->styles_.push_back(style);
+  return mImpl->styles_.size();
+}
+
+int ofxTrueTypeFontUC::getStyle(const string &name) {
+  for (int s = 0; s < (int)mImpl->styles_.size(); ++s) {
+    if (mImpl->styles_[s].name == name)
+      return s + 1;
+  }
+  return -1;
+}
+
+int ofxTrueTypeFontUC::getNumStyles() {
+  return mImpl->styles_.size() + 1;
+}
+
+void ofxTrueTypeFontUC::clearStyles() {
+  if (mImpl->styles_.empty())
+    return;
+  for (int s = 0; s < (int)mImpl->styles_.size(); ++s) {
+    if (mImpl->styles_[s].face != NULL)
+      FT_Done_Face(mImpl->styles_[s].face);
+  }
+  mImpl->styles_.clear();
+  // glyphs of the styles are keyed by style and would be found by new ones
+  if (mImpl->bLoadedOk_)
+    mImpl->implReserveCharacters(mImpl->limitCharactersNum_);
+}
+
+//-----------------------------------------------------------
+vector<ofxTrueTypeFontUC::StyleSpan> ofxTrueTypeFontUC::parseMarkup(const string &markup) {
+  vector<StyleSpan> spans;
+  vector<int> open(1, 0);  // styles of the open tags
+  string text;
+  size_t i = 0;
+  while (i < markup.size()) {
+    char c = markup[i];
+    if (c == '&') {
+      static const char *entities[] = {"&lt;", "<", "&gt;", ">", "&amp;", "&"};
+      bool escaped = false;
+      for (int e = 0; e < 6 && !escaped; e += 2) {
+        if (markup.compare(i, strlen(entities[e]), entities[e]) == 0) {
+          text += entities[e + 1];
+          i += strlen(entities[e]);
+          escaped = true;
+        }
+      }
+      if (!escaped) {
+        text += c;
+        i++;
+      }
+      continue;
+    }
+    
+    size_t close = (c == '<') ? markup.find('>', i) : string::npos;
+    if (close == string::npos) {
+      text += c;
+      i++;
+      continue;
+    }
+    bool closing = markup[i + 1] == '/';
+    int style = getStyle(markup.substr(i + (closing ? 2 : 1), close - i - (closing ? 2 : 1)));
+    if (style < 0 || (closing && (open.size() < 2 || open.back() != style))) {
+      text += c;
+      i++;
+      continue;
+    }
+    if (!text.empty()) {
+      spans.push_back(StyleSpan(text, open.back()));
+      text.clear();
+    }
+    if (closing)
+      open.pop_back();
+    else
+      open.push_back(style);
+    i = close + 1;
+  }
+  if (!text.empty())
+    spans.push_back(StyleSpan(text, open.back()));
+  return spans;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::drawSpans(const vector<StyleSpan> &spans, float x, float y) {
+  TTFUC_TRACE(trace, "drawSpans");
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "drawSpans(): font not allocated";
+    return;
+  }
+  
+  mImpl->layoutSpans(spans, [&](int cy, float X, float Y, bool) {
+    if (cy >= 0)
+      mImpl->drawChar(cy, x + X, y + Y);
+  });
+  mImpl->drawPageQuads();
+}
+
+void ofxTrueTypeFontUC::drawMarkup(const string &markup, float x, float y) {
+  drawSpans(parseMarkup(markup), x, y);
+}
+
+ofRectangle ofxTrueTypeFontUC::getSpansBoundingBox(const vector<StyleSpan> &spans, float x, float y) {
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "getSpansBoundingBox(): font not allocated";
+    return ofRectangle();
+  }
+  
+  vector<int> &glyphs = mImpl->spanGlyphs_;
+  vector<ofPoint> &positions = mImpl->spanPositions_;
+  glyphs.clear();
+  positions.clear();
+  mImpl->layoutSpans(spans, [&](int cy, float X, float Y, bool) {
+    if (cy >= 0) {
+      glyphs.push_back(cy);
+      positions.push_back(ofPoint(X, Y));
+    }
+  });
+  return getGlyphsBoundingBox(glyphs.data(), positions.data(), glyphs.size(), x, y);
+}
+
 //-----------------------------------------------------------
 bool ofxTrueTypeFontUC::isLoaded() {
   return mImpl->bLoadedOk_;
@@ -705,6 +2256,7 @@ int ofxTrueTypeFontUC::getFontSize() {
 //-----------------------------------------------------------
 void ofxTrueTypeFontUC::setLineHeight(float _newLineHeight) {
   mImpl->lineHeight_ = _newLineHeight;
+  mImpl->generation_++;
 }
 
 //-----------------------------------------------------------
@@ -715,6 +2267,7 @@ float ofxTrueTypeFontUC::getLineHeight() {
 //-----------------------------------------------------------
 void ofxTrueTypeFontUC::setLetterSpacing(float _newletterSpacing) {
   mImpl->letterSpacing_ = _newletterSpacing;
+  mImpl->generation_++;
 }
 
 //-----------------------------------------------------------
@@ -725,6 +2278,7 @@ float ofxTrueTypeFontUC::getLetterSpacing() {
 //-----------------------------------------------------------
 void ofxTrueTypeFontUC::setSpaceSize(float _newspaceSize) {
   mImpl->spaceSize_ = _newspaceSize;
+  mImpl->generation_++;
 }
 
 //-----------------------------------------------------------
@@ -746,36 +2300,73 @@ ofPath ofxTrueTypeFontUC::Impl::getCharacterAsPointsFromCharID(const int &charID
 }
 
 //-----------------------------------------------------------
-void ofxTrueTypeFontUC::Impl::drawChar(int c, float x, float y) {
+void ofxTrueTypeFontUC::Impl::drawChar(int c, float x, float y, bool turned) {
   
   if (c >= limitCharactersNum_) {
     //ofLog(OF_LOG_ERROR,"Error : char (%i) not allocated -- line %d in %s", (c + NUM_CHARACTER_TO_START), __LINE__,__FILE__);
     return;
   }
   
-  GLfloat	x1, y1, x2, y2;
-  GLfloat t1, v1, t2, v2;
-  t2 = cps[c].t2;
-  v2 = cps[c].v2;
-  t1 = cps[c].t1;
-  v1 = cps[c].v1;
+  ofVec3f vertices[4];
+  ofVec2f texCoords[4];
   
-  x1 = cps[c].x1+x;
-  y1 = cps[c].y1+y;
-  x2 = cps[c].x2+x;
-  y2 = cps[c].y2+y;
+  // effects first, baking them can open a new atlas page
+  if (!effects_.empty()) {
+    float alpha = ofGetStyle().color.a / 255.f;
+    for (int e = 0; e < (int)effects_.size(); ++e) {
+      const effectUC &effect = effects_[e];
+      const charPropsUC &cp = getEffectGlyph(e, c);
+      ofMesh &quads = effects_[e].quads[cp.page];
+      int firstIndex = quads.getVertices().size();
+      ofFloatColor color = effect.color;
+      color.a *= alpha;
+      if (turned) {
+        getGlyphQuad(cp, 0, 0, vertices, texCoords);
+        turnQuad(vertices, x + effect.offsetX, y + effect.offsetY);
+      }
+      else
+        getGlyphQuad(cp, x + effect.offsetX, y + effect.offsetY, vertices, texCoords);
+      for (int i = 0; i < 4; ++i) {
+        quads.addVertex(vertices[i]);
+        quads.addTexCoord(texCoords[i]);
+        quads.addColor(color);
+      }
+      quads.addIndex(firstIndex);
+      quads.addIndex(firstIndex+1);
+      quads.addIndex(firstIndex+2);
+      quads.addIndex(firstIndex+2);
+      quads.addIndex(firstIndex+3);
+      quads.addIndex(firstIndex);
+    }
+  }
   
-  int firstIndex = stringQuads.getVertices().size();
+  // drawn at a whole pixel from the variant rasterized at the rest
+  const charPropsUC *cp = &cps[c];
+  if (subpixelPhases_ > 1 && !turned) {
+    int phase;
+    x = snapToPhase(x, phase);
+    cp = &getPhaseGlyph(c, phase);
+  }
   
-  stringQuads.addVertex(ofVec3f(x1,y1));
-  stringQuads.addVertex(ofVec3f(x2,y1));
-  stringQuads.addVertex(ofVec3f(x2,y2));
-  stringQuads.addVertex(ofVec3f(x1,y2));
+  ofMesh & stringQuads = pageQuads[cp->page];
+  int firstIndex = stringQuads.getVertices().size();
   
-  stringQuads.addTexCoord(ofVec2f(t1,v1));
-  stringQuads.addTexCoord(ofVec2f(t2,v1));
-  stringQuads.addTexCoord(ofVec2f(t2,v2));
-  stringQuads.addTexCoord(ofVec2f(t1,v2));
+  if (turned) {
+    getGlyphQuad(*cp, 0, 0, vertices, texCoords);
+    turnQuad(vertices, x, y);
+  }
+  else
+    getGlyphQuad(*cp, x, y, vertices, texCoords);
+  for (int i = 0; i < 4; ++i) {
+    stringQuads.addVertex(vertices[i]);
+    stringQuads.addTexCoord(texCoords[i]);
+  }
+  // color glyphs aren't tinted, pages hold either kind only
+  if (cp->color) {
+    ofFloatColor white(1, 1, 1, ofGetStyle().color.a / 255.f);
+    for (int i = 0; i < 4; ++i)
+      stringQuads.addColor(white);
+  }
   
   stringQuads.addIndex(firstIndex);
   stringQuads.addIndex(firstIndex+1);
@@ -786,17 +2377,100 @@ void ofxTrueTypeFontUC::Impl::drawChar(int c, float x, float y) {
 }
 
 //-----------------------------------------------------------
-vector<ofPath> ofxTrueTypeFontUC::getStringAsPoints(const string &src, bool vflip){
-  vector<ofPath> shapes;
+void ofxTrueTypeFontUC::Impl::getGlyphQuad(int c, float x, float y, ofVec3f *vertices, ofVec2f *texCoords) {
+  getGlyphQuad(cps[c], x, y, vertices, texCoords);
+}
+
+void ofxTrueTypeFontUC::Impl::getGlyphQuad(const charPropsUC &cp, float x, float y, ofVec3f *vertices, ofVec2f *texCoords) {
+  GLfloat	x1, y1, x2, y2;
+  GLfloat t1, v1, t2, v2;
+  t2 = cp.t2;
+  v2 = cp.v2;
+  t1 = cp.t1;
+  v1 = cp.v1;
+  
+  x1 = cp.x1+x;
+  y1 = cp.y1+y;
+  x2 = cp.x2+x;
+  y2 = cp.y2+y;
+  
+  vertices[0].set(x1,y1,0);
+  vertices[1].set(x2,y1,0);
+  vertices[2].set(x2,y2,0);
+  vertices[3].set(x1,y2,0);
+  
+  texCoords[0].set(t1,v1);
+  texCoords[1].set(t2,v1);
+  texCoords[2].set(t2,v2);
+  texCoords[3].set(t1,v2);
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Impl::drawPageQuads() {
+  uploadDirtyPages();
   
+  bind();
+  // layer by layer, so that no effect covers a glyph on another page
+  for (int e = 0; e < (int)effects_.size(); ++e) {
+    for (int i = 0; i < (int)effects_[e].quads.size(); ++i)
+      drawQuads(effects_[e].quads[i], i);
+  }
+  for (int i = 0; i < (int)pageQuads.size(); ++i)
+    drawQuads(pageQuads[i], i);
+  unbind();
+  drawCount_++;
+  defragmentStep();
+}
+
+void ofxTrueTypeFontUC::Impl::drawQuads(ofMesh &quads, int page) {
+  if (quads.getNumIndices() == 0)
+    return;
+  if (useTextShaderUC()) {
+    // only what differs from the previous page is changed
+    const ofTextureData &texData = atlasPages[page].texture.getTextureData();
+    if (texData.textureID != boundTexture_) {
+      glBindTexture(texData.textureTarget, texData.textureID);
+      boundTexture_ = texData.textureID;
+    }
+    setVertexColors(quads.hasColors());
+    quads.drawFaces();
+  }
+  else {
+    atlasPages[page].texture.bind();
+    quads.drawFaces();
+    atlasPages[page].texture.unbind();
+  }
+  countDraw(quads.getNumIndices() / 6);
+  quads.clear();
+}
+
+//-----------------------------------------------------------
+vector<ofPath> ofxTrueTypeFontUC::getStringAsPoints(const string &src, bool vflip){
   if (!mImpl->bLoadedOk_) {
     ofLog(OF_LOG_ERROR,"Error : font not allocated -- line %d in %s", __LINE__,__FILE__);
-    return shapes;
+    return vector<ofPath>();
   }
-  
-  GLint index	= 0;
-  GLfloat X = 0;
-  GLfloat Y = 0;
+  return mImpl->implGetStringAsPoints(mImpl->decode(src), vflip);
+}
+
+vector<ofPath> ofxTrueTypeFontUC::getStringAsPoints(const u16string &src, bool vflip){
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "getStringAsPoints(): font not allocated";
+    return vector<ofPath>();
+  }
+  return mImpl->implGetStringAsPoints(mImpl->decode(src), vflip);
+}
+
+vector<ofPath> ofxTrueTypeFontUC::getStringAsPoints(const u32string &src, bool vflip){
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "getStringAsPoints(): font not allocated";
+    return vector<ofPath>();
+  }
+  return mImpl->implGetStringAsPoints(mImpl->decode(src), vflip);
+}
+
+vector<ofPath> ofxTrueTypeFontUC::Impl::implGetStringAsPoints(const basic_string<unsigned int> &utf32_src, bool vflip) {
+  vector<ofPath> shapes;
   int newLineDirection = 1;
   
   if (!vflip) {
@@ -806,30 +2480,14 @@ vector<ofPath> ofxTrueTypeFontUC::getStringAsPoints(const string &src, bool vfli
     newLineDirection = -1;
   }
   
-  basic_string<unsigned int> utf32_src = convToUTF32(src);
-  int len = (int)utf32_src.length();
-  int c, cy;
-  
-  while (index < len) {
-      c = utf32_src[index];
-      if (c == '\n') {
-          Y += mImpl->lineHeight_ * newLineDirection;
-          X = 0;
-      }
-      else if (c == ' ') {
-          cy = mImpl->getCharID('p');
-          X += mImpl->cps[cy].setWidth * mImpl->letterSpacing_ * mImpl->spaceSize_;
-      }
-      else {
-          cy = mImpl->getCharID(c);
-          if (mImpl->cps[cy].character == mImpl->kTypefaceUnloaded)
-              mImpl->loadChar(cy);
-          shapes.push_back(mImpl->getCharacterAsPointsFromCharID(cy));
-          shapes.back().translate(ofPoint(X,Y));
-          X += mImpl->cps[cy].setWidth * mImpl->letterSpacing_;
-      }
-    index++;
-  }
+  layoutText(utf32_src, [&](int cy, float X, float Y, bool turned) {
+    if (cy < 0)
+      return;
+    shapes.push_back(getCharacterAsPointsFromCharID(cy));
+    if (turned)
+      shapes.back().rotate(90 * newLineDirection, ofVec3f(0, 0, 1));
+    shapes.back().translate(ofPoint(X, Y * newLineDirection));
+  });
   
   return shapes;
 }
@@ -849,25 +2507,39 @@ void ofxTrueTypeFontUC::Impl::drawCharAsShape(int c, float x, float y) {
 }
 
 ofRectangle ofxTrueTypeFontUC::getStringBoundingBox(const string &src, float x, float y){
-  ofRectangle myRect;
-  
   if (!mImpl->bLoadedOk_) {
     ofLog(OF_LOG_ERROR,"ofxTrueTypeFontUC::getStringBoundingBox - font not allocated");
-    return myRect;
+    return ofRectangle();
   }
-  
-  basic_string<unsigned int> utf32_src = convToUTF32(src);
+  return mImpl->implGetStringBoundingBox(mImpl->decode(src), x, y);
+}
+
+ofRectangle ofxTrueTypeFontUC::getStringBoundingBox(const u16string &src, float x, float y){
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "getStringBoundingBox(): font not allocated";
+    return ofRectangle();
+  }
+  return mImpl->implGetStringBoundingBox(mImpl->decode(src), x, y);
+}
+
+ofRectangle ofxTrueTypeFontUC::getStringBoundingBox(const u32string &src, float x, float y){
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "getStringBoundingBox(): font not allocated";
+    return ofRectangle();
+  }
+  return mImpl->implGetStringBoundingBox(mImpl->decode(src), x, y);
+}
+
+ofRectangle ofxTrueTypeFontUC::Impl::implGetStringBoundingBox(const basic_string<unsigned int> &utf32_src, float x, float y) {
+  ofRectangle myRect;
   int len = (int)utf32_src.length();
   
-  GLint index = 0;
-  GLfloat xoffset	= 0;
-  GLfloat yoffset	= 0;
   float minx = -1;
   float miny = -1;
   float maxx = -1;
   float maxy = -1;
   
-  if (len < 1 || mImpl->cps.empty()) {
+  if (len < 1 || cps.empty()) {
     myRect.x = 0;
     myRect.y = 0;
     myRect.width = 0;
@@ -876,56 +2548,53 @@ ofRectangle ofxTrueTypeFontUC::getStringBoundingBox(const string &src, float x,
   }
   
   bool bFirstCharacter = true;
-  int c, cy;
-    
-  while (index < len)
-  {
-      c = utf32_src[index];
-      if (c == '\n') {
-          yoffset += mImpl->lineHeight_;
-          xoffset = 0 ; //reset X Pos back to zero
+  
+  // zach - this is a bug to fix -- for now, we don't currently deal with ' ' in calculating string bounding box
+  layoutText(utf32_src, [&](int cy, float xoffset, float yoffset, bool turned) {
+      if (cy < 0)
+          return;
+      GLint height = cps[cy].height;
+      GLint bwidth = cps[cy].width * letterSpacing_;
+      GLint top = cps[cy].topExtent - cps[cy].height;
+      GLint lextent	= cps[cy].leftExtent;
+      float	x1, y1, x2, y2, corr, stretch;
+      stretch = 0;
+      corr = (float)(((fontSize_ - height) + top) - fontSize_);
+      x1 = (lextent + bwidth + stretch);
+      y1 = (height + corr + stretch);
+      x2 = (lextent);
+      y2 = (-top + corr);
+      if (turned) {
+          // clockwise, x goes down and y to the left
+          float tx1 = -y2;
+          float tx2 = -y1;
+          y1 = x1;
+          y2 = x2;
+          x1 = tx1;
+          x2 = tx2;
       }
-      else if (c == ' ') {
-          cy = mImpl->getCharID('p');
-          xoffset += mImpl->cps[cy].width * mImpl->letterSpacing_ * mImpl->spaceSize_;
-          // zach - this is a bug to fix -- for now, we don't currently deal with ' ' in calculating string bounding box
+      x1 += x + xoffset;
+      y1 += y + yoffset;
+      x2 += x + xoffset;
+      y2 += y + yoffset;
+      if (bFirstCharacter == true) {
+          minx = x2;
+          miny = y2;
+          maxx = x1;
+          maxy = y1;
+          bFirstCharacter = false;
       }
       else {
-          cy = mImpl->getCharID(c);
-          if (mImpl->cps[cy].character == mImpl->kTypefaceUnloaded)
-              mImpl->loadChar(cy);
-          GLint height = mImpl->cps[cy].height;
-          GLint bwidth = mImpl->cps[cy].width * mImpl->letterSpacing_;
-          GLint top = mImpl->cps[cy].topExtent - mImpl->cps[cy].height;
-          GLint lextent	= mImpl->cps[cy].leftExtent;
-          float	x1, y1, x2, y2, corr, stretch;
-          stretch = 0;
-          corr = (float)(((mImpl->fontSize_ - height) + top) - mImpl->fontSize_);
-          x1 = (x + xoffset + lextent + bwidth + stretch);
-          y1 = (y + yoffset + height + corr + stretch);
-          x2 = (x + xoffset + lextent);
-          y2 = (y + yoffset + -top + corr);
-          xoffset += mImpl->cps[cy].setWidth * mImpl->letterSpacing_;
-          if (bFirstCharacter == true) {
+          if (x2 < minx)
               minx = x2;
+          if (y2 < miny)
               miny = y2;
+          if (x1 > maxx)
               maxx = x1;
+          if (y1 > maxy)
               maxy = y1;
-              bFirstCharacter = false;
-          }
-          else {
-              if (x2 < minx)
-                  minx = x2;
-              if (y2 < miny)
-                  miny = y2;
-              if (x1 > maxx)
-                  maxx = x1;
-              if (y1 > maxy)
-                  maxy = y1;
-          }
       }
-    index++;
-  }
+  });
   
   myRect.x = minx;
   myRect.y = miny;
@@ -940,53 +2609,570 @@ float ofxTrueTypeFontUC::stringWidth(const string &str) {
     return rect.width;
 }
 
+float ofxTrueTypeFontUC::stringWidth(const u16string &str) {
+  return getStringBoundingBox(str, 0, 0).width;
+}
+
+float ofxTrueTypeFontUC::stringWidth(const u32string &str) {
+  return getStringBoundingBox(str, 0, 0).width;
+}
+
 float ofxTrueTypeFontUC::stringHeight(const string &str) {
     ofRectangle rect = getStringBoundingBox(str, 0,0);
     return rect.height;
 }
 
+//-----------------------------------------------------------
+string ofxTrueTypeFontUC::truncateToWidth(const string &str, float maxWidth, const string &ellipsis) {
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "truncateToWidth(): font not allocated";
+    return str;
+  }
+  basic_string<unsigned int> codes = mImpl->decode(ellipsis);
+  float ellipsisWidth = mImpl->getAdvances(codes, mImpl->truncateAdvances);
+  return mImpl->truncate(str, maxWidth, codes, ellipsisWidth);
+}
 
-
-//=====================================================================
-void ofxTrueTypeFontUC::drawString(const string &src, float x, float y){
+vector<string> ofxTrueTypeFontUC::truncateToWidth(const vector<string> &strs, float maxWidth, const string &ellipsis) {
+  vector<string> truncated;
   if (!mImpl->bLoadedOk_) {
-    ofLog(OF_LOG_ERROR,"ofxTrueTypeFontUC::drawString - Error : font not allocated -- line %d in %s", __LINE__,__FILE__);
-    return;
+    ofLogError("ofxTrueTypeFontUC") << "truncateToWidth(): font not allocated";
+    return strs;
   }
-  
-  GLint index	= 0;
-  GLfloat X = x;
-  GLfloat Y = y;
-  
-  basic_string<unsigned int> utf32_src = convToUTF32(src);
-  int len = (int)utf32_src.length();
-  int c, cy;
+  // the ellipsis is measured once for the whole table
+  basic_string<unsigned int> codes = mImpl->decode(ellipsis);
+  float ellipsisWidth = mImpl->getAdvances(codes, mImpl->truncateAdvances);
+  truncated.reserve(strs.size());
+  for (size_t i = 0; i < strs.size(); ++i)
+    truncated.push_back(mImpl->truncate(strs[i], maxWidth, codes, ellipsisWidth));
+  return truncated;
+}
+
+// cuts every line of src that is wider than maxWidth, one decode and one
+// pass over its advances, then a binary search of their prefix sums
+string ofxTrueTypeFontUC::Impl::truncate(const string &src, float maxWidth, const basic_string<unsigned int> &ellipsis, float ellipsisWidth) {
+  basic_string<unsigned int> codes = decode(src);
+  basic_string<unsigned int> result;
+  bool cut = false;
+  size_t begin = 0;
+  while (begin <= codes.size()) {
+    size_t end = codes.find('\n', begin);
+    if (end == basic_string<unsigned int>::npos)
+      end = codes.size();
     
-  while (index < len) {
-      c = utf32_src[index];
-      if (c == '\n') {
-          Y += mImpl->lineHeight_;
-          X = x ; //reset X Pos back to zero
-      }
-      else if (c == ' ') {
-          int cy = mImpl->getCharID('p');
-          X += mImpl->cps[cy].width * mImpl->letterSpacing_ * mImpl->spaceSize_;
-      }
-      else {
-          cy = mImpl->getCharID(c);
-          if (mImpl->cps[cy].character == mImpl->kTypefaceUnloaded)
-              mImpl->loadChar(cy);
-          mImpl->bind(cy);
-          mImpl->drawChar(cy, X, Y);
-          mImpl->unbind(cy);
-          X += mImpl->cps[cy].setWidth * mImpl->letterSpacing_;
-      }
-    index++;
+    basic_string<unsigned int> line = codes.substr(begin, end - begin);
+    if (getAdvances(line, truncateAdvances) <= maxWidth)
+      result += line;
+    else {
+      // the longest prefix that leaves room for the ellipsis, without trailing spaces
+      int n = upper_bound(truncateAdvances.begin(), truncateAdvances.end(), maxWidth - ellipsisWidth) - truncateAdvances.begin() - 1;
+      n = max(n, 0);
+      while (n > 0 && line[n - 1] == ' ')
+        n--;
+      result.append(line, 0, n);
+      result += ellipsis;
+      cut = true;
+    }
+    if (end < codes.size())
+      result += '\n';
+    begin = end + 1;
   }
+  return cut ? convFromUTF32(result) : src;
 }
 
-//=====================================================================
-void ofxTrueTypeFontUC::drawStringAsShapes(const string &src, float x, float y){
+// prefix sums of the advances of a line, returns its width
+float ofxTrueTypeFontUC::Impl::getAdvances(const basic_string<unsigned int> &line, vector<float> &prefix) {
+  prefix.resize(line.size() + 1);
+  prefix[0] = 0;
+  float spaceAdvance = getSpaceAdvance();
+  for (size_t i = 0; i < line.size(); ++i) {
+    if (line[i] == ' ')
+      prefix[i + 1] = prefix[i] + spaceAdvance;
+    else
+      prefix[i + 1] = prefix[i] + cps[getLoadedCharID(line[i])].setWidth * letterSpacing_;
+  }
+  return prefix.back();
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::fitSizeToBox(const string &str, const ofRectangle &box) {
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "fitSizeToBox(): font not allocated";
+    return 0;
+  }
+  
+  // width and height of str at a size of 1, widths and line heights grow
+  // linearly with the size. outline fonts are measured in font units with
+  // FT_Get_Advance, so that no glyph is loaded or rasterized at any size
+  FT_Face face = mImpl->face_;
+  bool scalable = FT_IS_SCALABLE(face);
+  float unitsToSize = mImpl->dpi_ / 72.f / face->units_per_EM;
+  float spaceAdvance = mImpl->getSpaceAdvance() / mImpl->fontSize_;
+  basic_string<unsigned int> codes = mImpl->decode(str);
+  float width = 0;
+  float lineWidth = 0;
+  int numLines = 1;
+  for (size_t i = 0; i < codes.size(); ++i) {
+    if (codes[i] == '\n') {
+      numLines++;
+      lineWidth = 0;
+      continue;
+    }
+    if (codes[i] == ' ')
+      lineWidth += spaceAdvance;
+    else if (scalable) {
+      FT_Fixed advance = 0;
+      FT_Get_Advance(face, FT_Get_Char_Index(face, codes[i]), FT_LOAD_NO_SCALE, &advance);
+      lineWidth += advance * unitsToSize * mImpl->letterSpacing_;
+    }
+    else {
+      int cy = mImpl->getLoadedCharID(codes[i]);
+      lineWidth += mImpl->cps[cy].setWidth * mImpl->letterSpacing_ / mImpl->fontSize_;
+    }
+    width = max(width, lineWidth);
+  }
+  float height = numLines * mImpl->lineHeight_ / mImpl->fontSize_;
+  
+  // rounded down, a size rounded up would overflow the box
+  float size = box.height / height;
+  if (width > 0)
+    size = min(size, box.width / width);
+  return max((int)floor(size), 0);
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::getGlyph(unsigned int character) {
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "getGlyph(): font not allocated";
+    return -1;
+  }
+  return mImpl->getLoadedCharID(character);
+}
+
+int ofxTrueTypeFontUC::getGlyphFromIndex(unsigned int glyphIndex) {
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "getGlyphFromIndex(): font not allocated";
+    return -1;
+  }
+  if (glyphIndex >= (unsigned int)mImpl->face_->num_glyphs) {
+    ofLogError("ofxTrueTypeFontUC") << "getGlyphFromIndex(): no glyph " << glyphIndex << " in the face";
+    return -1;
+  }
+  return mImpl->getLoadedCharID(Impl::kGlyphIndexKey + glyphIndex);
+}
+
+float ofxTrueTypeFontUC::getGlyphAdvance(int glyph) {
+  if (!mImpl->isGlyph(glyph)) {
+    ofLogError("ofxTrueTypeFontUC") << "getGlyphAdvance(): invalid glyph " << glyph;
+    return 0;
+  }
+  return mImpl->cps[mImpl->useGlyph(glyph)].setWidth * mImpl->letterSpacing_;
+}
+
+void ofxTrueTypeFontUC::getGlyphRun(const string &src, vector<int> &glyphs, vector<ofPoint> &positions) {
+  glyphs.clear();
+  positions.clear();
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "getGlyphRun(): font not allocated";
+    return;
+  }
+  
+  basic_string<unsigned int> codes = mImpl->decode(src);
+  glyphs.reserve(codes.size());
+  positions.reserve(codes.size());
+  mImpl->layoutText(codes, [&](int cy, float X, float Y, bool) {
+    if (cy >= 0) {
+      glyphs.push_back(cy);
+      positions.push_back(ofPoint(X, Y));
+    }
+  });
+}
+
+void ofxTrueTypeFontUC::drawGlyphs(const vector<int> &glyphs, const vector<ofPoint> &positions, float x, float y) {
+  drawGlyphs(glyphs.data(), positions.data(), min(glyphs.size(), positions.size()), x, y);
+}
+
+void ofxTrueTypeFontUC::drawGlyphs(const int *glyphs, const ofPoint *positions, size_t count, float x, float y) {
+  TTFUC_TRACE(trace, "drawGlyphs");
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "drawGlyphs(): font not allocated";
+    return;
+  }
+  
+  for (size_t i = 0; i < count; ++i) {
+    if (mImpl->isGlyph(glyphs[i]))
+      mImpl->drawChar(mImpl->useGlyph(glyphs[i]), x + positions[i].x, y + positions[i].y);
+  }
+  mImpl->drawPageQuads();
+}
+
+void ofxTrueTypeFontUC::drawGlyphIndices(const unsigned int *glyphIndices, const ofPoint *positions, size_t count, float x, float y) {
+  TTFUC_TRACE(trace, "drawGlyphIndices");
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "drawGlyphIndices(): font not allocated";
+    return;
+  }
+  
+  for (size_t i = 0; i < count; ++i) {
+    if (glyphIndices[i] < (unsigned int)mImpl->face_->num_glyphs) {
+      int cy = mImpl->getLoadedCharID(Impl::kGlyphIndexKey + glyphIndices[i]);
+      mImpl->drawChar(cy, x + positions[i].x, y + positions[i].y);
+    }
+  }
+  mImpl->drawPageQuads();
+}
+
+ofRectangle ofxTrueTypeFontUC::getGlyphsBoundingBox(const int *glyphs, const ofPoint *positions, size_t count, float x, float y) {
+  ofRectangle rect(x, y, 0, 0);
+  bool first = true;
+  for (size_t i = 0; i < count; ++i) {
+    if (!mImpl->isGlyph(glyphs[i]))
+      continue;
+    // the same box as getStringBoundingBox() gives a character,
+    // height is the top of the bitmap and topExtent its rows
+    const charPropsUC &cp = mImpl->cps[mImpl->useGlyph(glyphs[i])];
+    ofRectangle box(x + positions[i].x + cp.leftExtent, y + positions[i].y - cp.height,
+                    (int)(cp.width * mImpl->letterSpacing_), cp.topExtent);
+    if (first)
+      rect = box;
+    else
+      rect.growToInclude(box);
+    first = false;
+  }
+  return rect;
+}
+
+//=====================================================================
+void ofxTrueTypeFontUC::drawString(const string &src, float x, float y){
+  TTFUC_TRACE(trace, "drawString");
+  if (!mImpl->bLoadedOk_) {
+    ofLog(OF_LOG_ERROR,"ofxTrueTypeFontUC::drawString - Error : font not allocated -- line %d in %s", __LINE__,__FILE__);
+    return;
+  }
+  
+  mImpl->addStringQuads(mImpl->decode(src), x, y);
+  mImpl->drawPageQuads();
+}
+
+void ofxTrueTypeFontUC::drawString(const u16string &src, float x, float y){
+  TTFUC_TRACE(trace, "drawString");
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "drawString(): font not allocated";
+    return;
+  }
+  
+  mImpl->addStringQuads(mImpl->decode(src), x, y);
+  mImpl->drawPageQuads();
+}
+
+void ofxTrueTypeFontUC::drawString(const u32string &src, float x, float y){
+  TTFUC_TRACE(trace, "drawString");
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "drawString(): font not allocated";
+    return;
+  }
+  
+  mImpl->addStringQuads(mImpl->decode(src), x, y);
+  mImpl->drawPageQuads();
+}
+
+void ofxTrueTypeFontUC::drawString(const string &src, float x, float y, ofAlignHorz horz, ofAlignVert vert){
+  TTFUC_TRACE(trace, "drawString");
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "drawString(): font not allocated";
+    return;
+  }
+  
+  mImpl->addStringQuads(mImpl->decode(src), x, y, horz, vert);
+  mImpl->drawPageQuads();
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Impl::addStringQuads(const basic_string<unsigned int> &utf32_src, float x, float y, ofAlignHorz horz, ofAlignVert vert) {
+  // aligned text is laid out from x and y like any other, then each line
+  // is shifted in place once its width is known, and the block once its height is.
+  // vertical text is drawn from x, y as it is
+  bool alignLines = !vertical_ && (horz == OF_ALIGN_HORZ_RIGHT || horz == OF_ALIGN_HORZ_CENTER);
+  bool alignBlock = !vertical_ && vert != OF_ALIGN_VERT_IGNORE;
+  if (alignLines)
+    markQuads(alignLineStarts);
+  if (alignBlock)
+    markQuads(alignBlockStarts);
+  
+  float Y = y;
+  layoutText(utf32_src, [&](int cy, float X, float lineY, bool turned) {
+    Y = y + lineY;
+    if (cy >= 0) {
+      drawChar(cy, x + X, Y, turned);
+    }
+    else if (alignLines) {
+      shiftQuads(alignLineStarts, horz == OF_ALIGN_HORZ_RIGHT ? -X : -X / 2, 0);
+      markQuads(alignLineStarts);
+    }
+  });
+  
+  if (alignBlock) {
+    // from the ascender of the first line to the descender of the last one
+    float top = y - getAscender();
+    float bottom = Y - face_->size->metrics.descender / 64.f;
+    float dy = 0;
+    if (vert == OF_ALIGN_VERT_TOP)
+      dy = y - top;
+    else if (vert == OF_ALIGN_VERT_BOTTOM)
+      dy = y - bottom;
+    else if (vert == OF_ALIGN_VERT_CENTER)
+      dy = y - (top + bottom) / 2;
+    shiftQuads(alignBlockStarts, 0, dy);
+  }
+}
+
+// remembers where the next quads of every layer and page will start
+void ofxTrueTypeFontUC::Impl::markQuads(vector<int> &starts) {
+  int numPages = pageQuads.size();
+  starts.resize((effects_.size() + 1) * numPages);
+  for (int i = 0; i < (int)starts.size(); ++i)
+    starts[i] = getLayerQuads(i / numPages, i % numPages).getNumVertices();
+}
+
+// moves the quads added since markQuads(), whole pixels keep subpixel positioned glyphs on their phase
+void ofxTrueTypeFontUC::Impl::shiftQuads(const vector<int> &starts, float dx, float dy) {
+  if (subpixelPhases_ > 1) {
+    dx = floor(dx + 0.5f);
+    dy = floor(dy + 0.5f);
+  }
+  if (dx == 0 && dy == 0)
+    return;
+  
+  // pages opened since then have all of their quads to move
+  int numPages = pageQuads.size();
+  int oldPages = starts.size() / (effects_.size() + 1);
+  ofVec3f offset(dx, dy, 0);
+  for (int layer = 0; layer < (int)effects_.size() + 1; ++layer) {
+    for (int page = 0; page < numPages; ++page) {
+      vector<ofVec3f> &vertices = getLayerQuads(layer, page).getVertices();
+      int first = page < oldPages ? starts[layer * oldPages + page] : 0;
+      for (int i = first; i < (int)vertices.size(); ++i)
+        vertices[i] += offset;
+    }
+  }
+}
+
+//=====================================================================
+void ofxTrueTypeFontUC::drawStrings(const vector<TextItem> &items){
+  if (!items.empty())
+    drawStrings(&items[0], items.size());
+}
+
+void ofxTrueTypeFontUC::drawStrings(const TextItem *items, size_t count){
+  if (!mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "drawStrings(): font not allocated";
+    return;
+  }
+  if (count == 0)
+    return;
+  
+  mImpl->implDrawStrings(items, count);
+}
+
+void ofxTrueTypeFontUC::Impl::implDrawStrings(const TextItem *items, size_t count) {
+  TTFUC_TRACE(trace, "drawStrings");
+  layoutStrings(items, count);
+  drawPageQuads();
+}
+
+// fills the quads of every layer and page, only (b) touches FreeType and the atlas
+void ofxTrueTypeFontUC::Impl::layoutStrings(const TextItem *items, size_t count) {
+  static const int kNewLine = -1;
+  static const int kSpace = -2;
+  static const size_t kGrain = 256;  // items per thread
+  
+  // (a) decode every string, this is independent per item
+  batchTexts.resize(count);
+  parallelFor(count, kGrain, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i)
+      batchTexts[i] = decode(items[i].text);
+  });
+  
+  // (b) resolve characters and bake their effects on this thread,
+  // FreeType and the atlas aren't thread safe
+  // subpixel variants are used for items that are neither rotated nor scaled,
+  // their pens are advanced here too to know which ones are needed
+  const int numLayers = effects_.size() + 1;
+  const float spaceAdvance = getSpaceAdvance();
+  const float turnedBaseline = getTurnedBaseline();
+  batchGlyphs.clear();
+  batchPhases.clear();
+  batchStarts.resize(count + 1);
+  for (size_t i = 0; i < count; ++i) {
+    batchStarts[i] = batchGlyphs.size();
+    const basic_string<unsigned int> &text = batchTexts[i];
+    bool snap = subpixelPhases_ > 1 && items[i].rotation == 0 && items[i].scale == 1 && !vertical_;
+    float X = 0;
+    for (size_t k = 0; k < text.size(); ++k) {
+      int phase = 0;
+      if (text[k] == '\n') {
+        batchGlyphs.push_back(kNewLine);
+        X = 0;
+      }
+      else if (text[k] == ' ') {
+        batchGlyphs.push_back(kSpace);
+        X += spaceAdvance;
+      }
+      else {
+        int cy = (vertical_ && isUpright(text[k])) ? getVerticalCharID(text[k]) : getLoadedCharID(text[k]);
+        for (int e = 0; e < numLayers - 1; ++e)
+          getEffectGlyph(e, cy);
+        if (snap) {
+          snapToPhase(items[i].position.x + X, phase);
+          getPhaseGlyph(cy, phase);
+        }
+        batchGlyphs.push_back(cy);
+        X += cps[cy].setWidth * letterSpacing_;
+      }
+      batchPhases.push_back(phase);
+    }
+  }
+  batchStarts[count] = batchGlyphs.size();
+  
+  // (c) reserve a range of quads on each page of each layer for every item,
+  // offsets are indexed by (item * numLayers + layer) * numPages + page
+  const int numPages = atlasPages.size();
+  const int numRanges = numLayers * numPages;
+  batchOffsets.assign(count * numRanges, 0);
+  vector<int> totals(numRanges, 0);
+  for (size_t i = 0; i < count; ++i) {
+    int *offsets = &batchOffsets[i * numRanges];
+    for (size_t k = batchStarts[i]; k < batchStarts[i+1]; ++k) {
+      int cy = batchGlyphs[k];
+      if (cy >= 0 && cy < limitCharactersNum_) {
+        for (int l = 0; l < numLayers; ++l)
+          offsets[l * numPages + getLayerGlyph(l, cy, batchPhases[k]).page]++;
+      }
+    }
+    for (int r = 0; r < numRanges; ++r) {
+      int n = offsets[r];
+      offsets[r] = totals[r];
+      totals[r] += n;
+    }
+  }
+  for (int r = 0; r < numRanges; ++r) {
+    ofMesh &mesh = getLayerQuads(r / numPages, r % numPages);
+    mesh.clear();
+    mesh.getVertices().resize(totals[r] * 4);
+    mesh.getTexCoords().resize(totals[r] * 4);
+    mesh.getColors().resize(totals[r] * 4);
+    mesh.getIndices().resize(totals[r] * 6);
+  }
+  
+  // (d) lay out and transform every item into its own ranges
+  parallelFor(count, kGrain, [&](size_t begin, size_t end) {
+    vector<int> cursor(numRanges);
+    for (size_t i = begin; i < end; ++i) {
+      const TextItem &item = items[i];
+      for (int r = 0; r < numRanges; ++r)
+        cursor[r] = batchOffsets[i * numRanges + r];
+      
+      float angle = item.rotation * DEG_TO_RAD;
+      float ca = cos(angle) * item.scale;
+      float sa = sin(angle) * item.scale;
+      float X = 0;
+      float Y = 0;
+      
+      for (size_t k = batchStarts[i]; k < batchStarts[i+1]; ++k) {
+        int cy = batchGlyphs[k];
+        if (cy == kNewLine) {
+          if (vertical_) {
+            X -= lineHeight_;
+            Y = 0;
+          }
+          else {
+            Y += lineHeight_;
+            X = 0;
+          }
+          continue;
+        }
+        if (cy == kSpace) {
+          (vertical_ ? Y : X) += spaceAdvance;
+          continue;
+        }
+        if (cy >= limitCharactersNum_)
+          continue;
+        
+        // as layoutVertical() places them, without shaping
+        bool turned = vertical_ && !isUpright(batchTexts[i][k - batchStarts[i]]);
+        float penX = X;
+        float penY = Y;
+        if (turned)
+          penX += turnedBaseline;
+        else if (vertical_) {
+          penX += cps[cy].vertOriginX;
+          penY += cps[cy].vertOriginY;
+        }
+        
+        int phase = batchPhases[k];
+        for (int l = 0; l < numLayers; ++l) {
+          // the baked effects and variants were all loaded in (b), so this doesn't touch the atlas
+          const charPropsUC &cp = l < numLayers - 1 ? effects_[l].cps[cy] : phase > 0 ? phaseCps[phase - 1][cy] : cps[cy];
+          ofMesh &mesh = getLayerQuads(l, cp.page);
+          int q = cursor[l * numPages + cp.page]++;
+          float dx = penX;
+          float dy = penY;
+          if (l == numLayers - 1 && subpixelPhases_ > 1 && item.rotation == 0 && item.scale == 1 && !vertical_) {
+            int unused;
+            dx = snapToPhase(item.position.x + X, unused) - item.position.x;
+          }
+          ofFloatColor color = item.color;
+          if (cp.color)
+            color.set(1, 1, 1, item.color.a);
+          if (l < numLayers - 1) {
+            dx += effects_[l].offsetX;
+            dy += effects_[l].offsetY;
+            color = effects_[l].color;
+            color.a *= item.color.a;
+          }
+          
+          float xs[4] = {cp.x1, cp.x2, cp.x2, cp.x1};
+          float ys[4] = {cp.y1, cp.y1, cp.y2, cp.y2};
+          for (int j = 0; j < 4; ++j) {
+            if (turned) {
+              float t = xs[j];
+              xs[j] = -ys[j];
+              ys[j] = t;
+            }
+            xs[j] += dx;
+            ys[j] += dy;
+          }
+          for (int j = 0; j < 4; ++j) {
+            mesh.getVertices()[q*4+j] = ofVec3f(item.position.x + xs[j]*ca - ys[j]*sa,
+                                                item.position.y + xs[j]*sa + ys[j]*ca);
+            mesh.getColors()[q*4+j] = color;
+          }
+          mesh.getTexCoords()[q*4+0] = ofVec2f(cp.t1,cp.v1);
+          mesh.getTexCoords()[q*4+1] = ofVec2f(cp.t2,cp.v1);
+          mesh.getTexCoords()[q*4+2] = ofVec2f(cp.t2,cp.v2);
+          mesh.getTexCoords()[q*4+3] = ofVec2f(cp.t1,cp.v2);
+          
+          ofIndexType firstIndex = q*4;
+          ofIndexType * indices = &mesh.getIndices()[q*6];
+          indices[0] = firstIndex;
+          indices[1] = firstIndex+1;
+          indices[2] = firstIndex+2;
+          indices[3] = firstIndex+2;
+          indices[4] = firstIndex+3;
+          indices[5] = firstIndex;
+        }
+        
+        if (!vertical_)
+          X += cps[cy].setWidth * letterSpacing_;
+        else
+          Y += (turned ? cps[cy].setWidth : cps[cy].vertAdvance) * letterSpacing_;
+      }
+    }
+  });
+}
+
+//=====================================================================
+void ofxTrueTypeFontUC::drawStringAsShapes(const string &src, float x, float y){
   
   if (!mImpl->bLoadedOk_) {
     ofLogError("ofxTrueTypeFontUC") << "drawStringAsShapes(): font not allocated: line " << __LINE__ << " in " << __FILE__;
@@ -1003,7 +3189,7 @@ void ofxTrueTypeFontUC::drawStringAsShapes(const string &src, float x, float y){
   GLfloat X = x;
   GLfloat Y = y;
   
-  basic_string<unsigned int> utf32_src = convToUTF32(src);
+  basic_string<unsigned int> utf32_src = mImpl->decode(src);
   int len = (int)utf32_src.length();
   
   int c, cy;
@@ -1016,15 +3202,12 @@ void ofxTrueTypeFontUC::drawStringAsShapes(const string &src, float x, float y){
           X = x ; //reset X Pos back to zero
       }
       else if (c == ' ') {
-          cy = mImpl->getCharID('p');
-          X += mImpl->cps[cy].width;
+          X += mImpl->getSpaceAdvance();
       }
       else {
-          cy = mImpl->getCharID(c);
-          if (mImpl->cps[cy].character == mImpl->kTypefaceUnloaded)
-              mImpl->loadChar(cy);
+          cy = mImpl->getLoadedCharID(c);
           mImpl->drawCharAsShape(cy, X, Y);
-          X += mImpl->cps[cy].setWidth;
+          X += mImpl->cps[cy].setWidth * mImpl->letterSpacing_;
       }
       index++;
   }
@@ -1038,57 +3221,66 @@ int ofxTrueTypeFontUC::getLoadedCharactersCount() {
 //=====================================================================
 const int ofxTrueTypeFontUC::Impl::kTypefaceUnloaded = 0;
 const int ofxTrueTypeFontUC::Impl::kDefaultLimitCharactersNum = 10000;
+const int ofxTrueTypeFontUC::Impl::kAtlasPageSize = 1024;
+const int ofxTrueTypeFontUC::Impl::kDefaultColorPageLimit = 4;
+const int ofxTrueTypeFontUC::Impl::kMaxSubpixelPhases = 4;
+const int ofxTrueTypeFontUC::Impl::kEffectOutline = 0;
+const int ofxTrueTypeFontUC::Impl::kEffectShadow = 1;
+const int ofxTrueTypeFontUC::Impl::kEffectGlow = 2;
+// above the last code point of unicode
+const int ofxTrueTypeFontUC::Impl::kGlyphIndexKey = 0x40000000;
+const int ofxTrueTypeFontUC::Impl::kShapedRunCacheSize = 256;
+const int ofxTrueTypeFontUC::Impl::kBidiRunCacheSize = 256;
+// between the last code point of unicode and kGlyphIndexKey
+const int ofxTrueTypeFontUC::Impl::kStyleShift = 22;
+const int ofxTrueTypeFontUC::Impl::kMaxStyles = 256;
 
 //-----------------------------------------------------------
-void ofxTrueTypeFontUC::Impl::bind(const int & charID) {
+// shader replaces the text shader, with the programmable renderers only
+void ofxTrueTypeFontUC::Impl::bind(ofShader *shader) {
   if (!binded_) {
-    // we need transparency to draw text, but we don't know
-    // if that is set up in outside of this function
-    // we "pushAttrib", turn on alpha and "popAttrib"
-    // http://www.opengl.org/documentation/specs/man_pages/hardcopy/GL/html/gl/pushattrib.html
-    
-    // **** note ****
-    // I have read that pushAttrib() is slow, if used often,
-    // maybe there is a faster way to do this?
-    // ie, check if blending is enabled, etc...
-    // glIsEnabled().... glGet()...
-    // http://www.opengl.org/documentation/specs/man_pages/hardcopy/GL/html/gl/get.html
-    // **************
-    // (a) record the current "alpha state, blend func, etc"
-#ifndef TARGET_OPENGLES
-    glPushAttrib(GL_COLOR_BUFFER_BIT);
-#else
-    blend_enabled_ = glIsEnabled(GL_BLEND);
-    texture_2d_enabled_ = glIsEnabled(GL_TEXTURE_2D);
-    glGetIntegerv( GL_BLEND_SRC, &blend_src);
-    glGetIntegerv( GL_BLEND_DST, &blend_dst_ );
-#endif
+    // we need alpha blending to draw text. the blend mode of the app is
+    // the one oF keeps in the style, so it is neither pushed nor queried
+    // from GL, and nothing is changed when it is already alpha blending
+    blendMode_ = ofGetStyle().blendingMode;
+    if (blendMode_ != OF_BLENDMODE_ALPHA)
+      ofEnableBlendMode(OF_BLENDMODE_ALPHA);
     
-    // (b) enable our regular ALPHA blending!
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    if (useTextShaderUC()) {
+      shader_ = shader != NULL ? shader : &textShaderUC;
+      shader_->begin();
+      glActiveTexture(GL_TEXTURE0);
+      boundTexture_ = 0;
+      // plain quads take this tint, set here rather than left to the
+      // renderer so that it matches the style at bind()
+      ofFloatColor color = ofGetStyle().color;
+      shader_->setUniform4f("globalColor", color.r, color.g, color.b, color.a);
+      shader_->setUniform1i("vertexColors", 0);
+      vertexColors_ = false;
+    }
     
-    textures[charID].bind();
-    stringQuads.clear();
     binded_ = true;
   }
 }
 
+// whether the next quads carry their own colors or take the color of the style
+void ofxTrueTypeFontUC::Impl::setVertexColors(bool colors) {
+  if (binded_ && useTextShaderUC() && colors != vertexColors_) {
+    shader_->setUniform1i("vertexColors", colors);
+    vertexColors_ = colors;
+  }
+}
+
 //-----------------------------------------------------------
-void ofxTrueTypeFontUC::Impl::unbind(const int & charID) {
+void ofxTrueTypeFontUC::Impl::unbind() {
   if (binded_) {
-    stringQuads.drawFaces();
-    textures[charID].unbind();
-    
-#ifndef TARGET_OPENGLES
-    glPopAttrib();
-#else
-    if (!blend_enabled_)
-      glDisable(GL_BLEND);
-    if  (!texture_2d_enabled_)
-      glDisable(GL_TEXTURE_2D);
-    glBlendFunc( blend_src, blend_dst_ );
-#endif
+    if (useTextShaderUC()) {
+      if (boundTexture_ != 0)
+        glBindTexture(GL_TEXTURE_2D, 0);
+      shader_->end();
+    }
+    if (blendMode_ != OF_BLENDMODE_ALPHA)
+      ofEnableBlendMode(blendMode_);
     binded_ = false;
   }
 }
@@ -1108,18 +3300,29 @@ void ofxTrueTypeFontUC::Impl::implReserveCharacters(int num) {
     return;
   
   limitCharactersNum_ = num;
+  generation_++;
+  cancelDefragment();
   
   vector<charPropsUC>().swap(cps);
-  vector<ofTexture>().swap(textures);
+  residentGlyphs_ = 0;
+  outlineBytes_ = 0;
+  vector<atlasPageUC>().swap(atlasPages);
+  fill(fillPage_, fillPage_ + 5, -1);
+  drawCount_ = 0;
+  vector<ofMesh>().swap(pageQuads);
   vector<int>().swap(loadedChars);
+  unordered_map<int, int>().swap(charIDs);
   vector<ofPath>().swap(charOutlines);
   
   //--------------- initialize character info and textures
   cps.resize(limitCharactersNum_);
   for (int i=0; i<limitCharactersNum_; ++i)
     cps[i].character = kTypefaceUnloaded;
-  
-  textures.resize(limitCharactersNum_);
+  for (int e = 0; e < (int)effects_.size(); ++e) {
+    vector<charPropsUC>(limitCharactersNum_, cps[0]).swap(effects_[e].cps);
+    vector<ofMesh>().swap(effects_[e].quads);
+  }
+  vector<vector<charPropsUC> >(subpixelPhases_ - 1, vector<charPropsUC>(limitCharactersNum_, cps[0])).swap(phaseCps);
   
   if (bMakeContours_) {
     charOutlines.clear();
@@ -1134,86 +3337,677 @@ void ofxTrueTypeFontUC::Impl::implReserveCharacters(int num) {
 //-----------------------------------------------------------
 int ofxTrueTypeFontUC::Impl::getCharID(const int &c) {
   int tmp = (int)c;
-  int point = 0;
-  for (; point != (int)loadedChars.size(); ++point) {
-    if (loadedChars[point] == tmp) {
-      break;
-    }
-  }
-  if (point == loadedChars.size()) {
-    //----------------------- error checking
-    if (point >= limitCharactersNum_) {
-      ofLog(OF_LOG_ERROR,"ofxTrueTypeFontUC::getCharID - Error : too many typeface already loaded - call loadFont to reset");
-      return point = 0;
-    }
-    else {
-      loadedChars.push_back(tmp);
-    }
+  unordered_map<int, int>::const_iterator it = charIDs.find(tmp);
+  if (it != charIDs.end())
+    return it->second;
+  
+  int point = loadedChars.size();
+  //----------------------- error checking
+  if (point >= limitCharactersNum_) {
+    ofLog(OF_LOG_ERROR,"ofxTrueTypeFontUC::getCharID - Error : too many typeface already loaded - call loadFont to reset");
+    return point = 0;
   }
+  loadedChars.push_back(tmp);
+  charIDs[tmp] = point;
   return point;
 }
 
 //-----------------------------------------------------------
-void ofxTrueTypeFontUC::Impl::loadChar(const int &charID) {
-  int i = charID;
-  ofPixels expandedData;
+int ofxTrueTypeFontUC::Impl::getLoadedCharID(const int &c) {
+  return useGlyph(getCharID(c));
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::Impl::useGlyph(int cy) {
+  statLookups_.fetch_add(1, memory_order_relaxed);
+  if (cps[cy].character == kTypefaceUnloaded) {
+    statMisses_.fetch_add(1, memory_order_relaxed);
+    loadChar(cy);
+  }
+  if (cps[cy].color)
+    atlasPages[cps[cy].page].lastUsed = drawCount_;
+  return cy;
+}
+
+//-----------------------------------------------------------
+basic_string<unsigned int> ofxTrueTypeFontUC::Impl::decode(const string &src) {
+  statBytesDecoded_.fetch_add(src.size(), memory_order_relaxed);
+  return convToUTF32(src);
+}
+
+// bytesDecoded counts UTF-8 only, like u32string this isn't counted
+basic_string<unsigned int> ofxTrueTypeFontUC::Impl::decode(const u16string &src) {
+  return convUTF16ToUTF32(src.data(), src.size());
+}
+
+// nothing to decode, only copied to the type of the layout
+basic_string<unsigned int> ofxTrueTypeFontUC::Impl::decode(const u32string &src) {
+  return basic_string<unsigned int>(src.begin(), src.end());
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Impl::countDraw(int quads) {
+  statDrawCalls_.fetch_add(1, memory_order_relaxed);
+  statQuads_.fetch_add(quads, memory_order_relaxed);
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Impl::resetStats() {
+  statLookups_.store(0, memory_order_relaxed);
+  statMisses_.store(0, memory_order_relaxed);
+  statRasterizations_.store(0, memory_order_relaxed);
+  statRasterizationMicros_.store(0, memory_order_relaxed);
+  statDrawCalls_.store(0, memory_order_relaxed);
+  statQuads_.store(0, memory_order_relaxed);
+  statBytesDecoded_.store(0, memory_order_relaxed);
+  statShapeHits_.store(0, memory_order_relaxed);
+  statShapeMisses_.store(0, memory_order_relaxed);
+  statShapingMicros_.store(0, memory_order_relaxed);
+  statDefragPages_.store(0, memory_order_relaxed);
+  statDefragGlyphs_.store(0, memory_order_relaxed);
+  statDefragMicros_.store(0, memory_order_relaxed);
+}
+
+//-----------------------------------------------------------
+ofxTrueTypeFontUC::Stats ofxTrueTypeFontUC::getStats() {
+  Stats stats;
+  Impl *impl = mImpl;
+  stats.glyphLookups = impl->statLookups_.load(memory_order_relaxed);
+  stats.glyphMisses = impl->statMisses_.load(memory_order_relaxed);
+  stats.glyphHits = stats.glyphLookups - stats.glyphMisses;
+  stats.rasterizations = impl->statRasterizations_.load(memory_order_relaxed);
+  stats.rasterizationMicros = impl->statRasterizationMicros_.load(memory_order_relaxed);
+  stats.residentGlyphs = impl->residentGlyphs_;
+  stats.glyphLimit = impl->limitCharactersNum_;
   
-  //------------------------------------------ anti aliased or not:
-  FT_Error err = FT_Load_Glyph( face_, FT_Get_Char_Index( face_, loadedChars[i] ), FT_LOAD_DEFAULT );
-  if(err)
-    ofLog(OF_LOG_ERROR,"ofxTrueTypeFontUC::loadFont - Error with FT_Load_Glyph %i: FT_Error = %d", loadedChars[i], err);
+  stats.atlasPages = impl->atlasPages.size();
+  stats.atlasBytes = 0;
+  stats.atlasTextureBytes = 0;
+  uint64_t usedPixels = 0;
+  uint64_t deadPixels = 0;
+  uint64_t totalPixels = 0;
+  for (int i = 0; i < (int)impl->atlasPages.size(); ++i) {
+    const atlasPageUC &pg = impl->atlasPages[i];
+    size_t bytes = pg.size * pg.size * pg.channels;
+    stats.atlasBytes += pg.packed.empty() ? bytes : pg.packed.size();
+    if (pg.texture.isAllocated())
+      stats.atlasTextureBytes += bytes;
+    usedPixels += pg.usedPixels;
+    deadPixels += pg.deadPixels;
+    totalPixels += pg.size * pg.size;
+  }
+  stats.atlasOccupancy = totalPixels > 0 ? float(usedPixels - deadPixels) / float(totalPixels) : 0;
+  stats.atlasFragmentation = usedPixels > 0 ? float(deadPixels) / float(usedPixels) : 0;
+  stats.outlineBytes = impl->outlineBytes_;
   
-  if (bAntiAliased_ == true)
-    FT_Render_Glyph(face_->glyph, FT_RENDER_MODE_NORMAL);
-  else
-    FT_Render_Glyph(face_->glyph, FT_RENDER_MODE_MONO);
+  stats.drawCalls = impl->statDrawCalls_.load(memory_order_relaxed);
+  stats.quads = impl->statQuads_.load(memory_order_relaxed);
+  stats.bytesDecoded = impl->statBytesDecoded_.load(memory_order_relaxed);
+  stats.shapedRunHits = impl->statShapeHits_.load(memory_order_relaxed);
+  stats.shapedRunMisses = impl->statShapeMisses_.load(memory_order_relaxed);
+  stats.shapingMicros = impl->statShapingMicros_.load(memory_order_relaxed);
+  stats.defragmentedPages = impl->statDefragPages_.load(memory_order_relaxed);
+  stats.movedGlyphs = impl->statDefragGlyphs_.load(memory_order_relaxed);
+  stats.defragmentationMicros = impl->statDefragMicros_.load(memory_order_relaxed);
+  return stats;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::resetStats() {
+  mImpl->resetStats();
+}
+
+//-----------------------------------------------------------
+float ofxTrueTypeFontUC::Impl::getSpaceAdvance(int style) {
+  // the 'p' of the font is loaded with it, the ones of styles when first needed
+  int cy = style == 0 ? getCharID('p') : getLoadedCharID(getStyleKey(style, 'p'));
+  return cps[cy].width * letterSpacing_ * spaceSize_;
+}
+
+//-----------------------------------------------------------
+float ofxTrueTypeFontUC::Impl::getAscender() {
+  return face_->size->metrics.ascender / 64.f;
+}
+
+//-----------------------------------------------------------
+bool ofxTrueTypeFontUC::Impl::allocateAtlasRect(int w, int h, int channels, int &page, int &x, int &y) {
+  // glyphs go to the page being filled with their kind, which for color
+  // glyphs isn't the newest one once pages are reused
+  page = fillPage_[channels];
+  if (page >= 0) {
+    atlasPageUC &pg = atlasPages[page];
+    if (pg.penX + w > pg.size) {
+      // start a new shelf
+      pg.penY += pg.shelfHeight;
+      pg.penX = 0;
+      pg.shelfHeight = 0;
+    }
+    if (pg.penX + w <= pg.size && pg.penY + h <= pg.size) {
+      x = pg.penX;
+      y = pg.penY;
+      pg.penX += w;
+      pg.shelfHeight = max(pg.shelfHeight, h);
+      pg.usedPixels += w * h;
+      return true;
+    }
+  }
   
-  //------------------------------------------
-  FT_Bitmap& bitmap= face_->glyph->bitmap;
+  // reuse the least recently drawn color page when there are enough of them
+  int numColorPages = 0;
+  for (int i = 0; i < (int)atlasPages.size(); ++i) {
+    if (atlasPages[i].channels == 4)
+      numColorPages++;
+  }
+  page = -1;
+  if (channels == 4 && numColorPages >= colorPageLimit_)
+    page = evictColorPage();
   
-  // prepare the texture:
-  /*int width  = ofNextPow2( bitmap.width + border*2 );
-   int height = ofNextPow2( bitmap.rows  + border*2 );
-   
-   
-   // ------------------------- this is fixing a bug with small type
-   // ------------------------- appearantly, opengl has trouble with
-   // ------------------------- width or height textures of 1, so we
-   // ------------------------- we just set it to 2...
-   if (width == 1) width = 2;
-   if (height == 1) height = 2;*/
+  // or open a new page, big enough for huge glyphs too
+  int size = kAtlasPageSize;
+  while (size < w || size < h)
+    size <<= 1;
   
-  if (bMakeContours_) {
-    if (printVectorInfo_)
-      printf("\n\ncharacter charID %d: \n", i );
-    
-    charOutlines[i] = makeContoursForCharacter(face_);
-    if (simplifyAmt_>0)
-      charOutlines[i].simplify(simplifyAmt_);
-    charOutlines[i].getTessellation();
+  if (page < 0 || atlasPages[page].size < size) {
+    page = atlasPages.size();
+    atlasPages.push_back(atlasPageUC());
+    pageQuads.push_back(ofMesh());
+    pageQuads.back().setMode(OF_PRIMITIVE_TRIANGLES);
+    for (int e = 0; e < (int)effects_.size(); ++e) {
+      effects_[e].quads.push_back(ofMesh());
+      effects_[e].quads.back().setMode(OF_PRIMITIVE_TRIANGLES);
+    }
+    atlasPages[page].size = size;
+    atlasPages[page].channels = channels;
   }
   
-  // -------------------------
-  // info about the character:
-  cps[i].character = loadedChars[i];
-  cps[i].height = face_->glyph->bitmap_top;
-  cps[i].width = face_->glyph->bitmap.width;
-  cps[i].setWidth = face_->glyph->advance.x >> 6;
-  cps[i].topExtent = face_->glyph->bitmap.rows;
-  cps[i].leftExtent = face_->glyph->bitmap_left;
-  
-  int width = cps[i].width;
-  int height = bitmap.rows;
+  fillPage_[channels] = page;
+  atlasPageUC &pg = atlasPages[page];
+  // an evicted page may be packed
+  vector<unsigned char>().swap(pg.packed);
+  if (!pg.pixels.isAllocated())
+    pg.pixels.allocate(pg.size, pg.size, channels);
+  if (channels == 2) {
+    pg.pixels.set(0,255);
+    pg.pixels.set(1,0);
+  }
+  else
+    pg.pixels.set(0);
+  pg.penX = w;
+  pg.penY = 0;
+  pg.shelfHeight = h;
+  pg.dirtyTop = 0;
+  pg.dirtyBottom = pg.size;
+  pg.usedPixels = w * h;
+  pg.deadPixels = 0;
+  pg.lastUsed = drawCount_;
   
-  cps[i].tW = width;
-  cps[i].tH = height;
+  x = 0;
+  y = 0;
+  return true;
+}
+
+//-----------------------------------------------------------
+// drops the glyphs of the least recently drawn color page, -1 when every
+// color page is used by the draw being built
+int ofxTrueTypeFontUC::Impl::evictColorPage() {
+  int page = -1;
+  for (int i = 0; i < (int)atlasPages.size(); ++i) {
+    const atlasPageUC &pg = atlasPages[i];
+    if (pg.channels != 4 || pg.lastUsed == drawCount_)
+      continue;
+    if (page < 0 || drawCount_ - pg.lastUsed > drawCount_ - atlasPages[page].lastUsed)
+      page = i;
+  }
+  if (page < 0)
+    return -1;
   
-  GLint fheight = cps[i].height;
-  GLint bwidth = cps[i].width;
-  GLint top = cps[i].topExtent - cps[i].height;
-  GLint lextent	= cps[i].leftExtent;
+  for (int i = 0; i < (int)cps.size(); ++i) {
+    if (cps[i].character != kTypefaceUnloaded && cps[i].color && cps[i].page == page) {
+      cps[i].character = kTypefaceUnloaded;
+      residentGlyphs_--;
+    }
+  }
+  // retained text may still point into the page
+  generation_++;
+  return page;
+}
+
+//-----------------------------------------------------------
+// scales a premultiplied BGRA bitmap once with a box filter,
+// and stores it as straight alpha RGBA
+void ofxTrueTypeFontUC::Impl::loadColorGlyph(charPropsUC &cp, FT_Face face, float scale) {
+  // off every page, so that making room for it can't evict it
+  cp.page = -1;
+  const FT_Bitmap &bitmap = face->glyph->bitmap;
+  int width = max(0, (int)floor(bitmap.width * scale + 0.5f));
+  int height = max(0, (int)floor(bitmap.rows * scale + 0.5f));
+  int left = floor(face->glyph->bitmap_left * scale + 0.5f);
+  int top = floor(face->glyph->bitmap_top * scale + 0.5f);
   
-  GLfloat	corr, stretch;
+  cp.width = width;
+  cp.height = top;
+  cp.setWidth = face->glyph->advance.x / 64.f * scale;
+  cp.vertAdvance *= scale;
+  cp.vertOriginX *= scale;
+  cp.vertOriginY *= scale;
+  cp.topExtent = height;
+  cp.leftExtent = left;
+  cp.tW = width;
+  cp.tH = height;
+  cp.x1 = left + width;
+  cp.x2 = left;
+  cp.y1 = height - top;
+  cp.y2 = -top;
+  
+  ofPixels pixels;
+  pixels.allocate(width, height, 4);
+  for (int y = 0; y < height; ++y) {
+    int sy0 = min((int)(y / scale), (int)bitmap.rows - 1);
+    int sy1 = max(sy0 + 1, min((int)((y + 1) / scale), (int)bitmap.rows));
+    for (int x = 0; x < width; ++x) {
+      int sx0 = min((int)(x / scale), (int)bitmap.width - 1);
+      int sx1 = max(sx0 + 1, min((int)((x + 1) / scale), (int)bitmap.width));
+      unsigned int sum[4] = {0, 0, 0, 0};
+      for (int sy = sy0; sy < sy1; ++sy) {
+        const unsigned char *src = bitmap.buffer + sy * bitmap.pitch + sx0 * 4;
+        for (int sx = sx0; sx < sx1; ++sx, src += 4) {
+          sum[0] += src[0];
+          sum[1] += src[1];
+          sum[2] += src[2];
+          sum[3] += src[3];
+        }
+      }
+      unsigned int n = (sy1 - sy0) * (sx1 - sx0);
+      unsigned int a = sum[3] / n;
+      unsigned char *dst = pixels.getData() + (y * width + x) * 4;
+      dst[0] = a ? min(255u, sum[2] / n * 255 / a) : 0;
+      dst[1] = a ? min(255u, sum[1] / n * 255 / a) : 0;
+      dst[2] = a ? min(255u, sum[0] / n * 255 / a) : 0;
+      dst[3] = a;
+    }
+  }
+  packGlyph(cp, pixels);
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Impl::packGlyph(charPropsUC &cp, const ofPixels &pixels) {
+  int width = pixels.getWidth();
+  int height = pixels.getHeight();
+  int page, px, py;
+  allocateAtlasRect(width + border_*2, height + border_*2, pixels.getNumChannels(), page, px, py);
+  atlasPageUC &pg = atlasPages[page];
+  int w = pg.pixels.getWidth();
+  int h = pg.pixels.getHeight();
+  
+  cp.page = page;
+  cp.t2 = float(px + border_) / float(w);
+  cp.v2 = float(py + border_) / float(h);
+  cp.t1 = float(px + width + border_) / float(w);
+  cp.v1 = float(py + height + border_) / float(h);
+  if (width > 0 && height > 0)
+    pixels.pasteInto(pg.pixels, px + border_, py + border_);
+  
+  // the texture is updated lazily, right before the next draw
+  pg.dirtyTop = min(pg.dirtyTop, py);
+  pg.dirtyBottom = max(pg.dirtyBottom, py + height + border_*2);
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Impl::uploadDirtyPages() {
+  TTFUC_TRACE(trace, "upload");
+  for (int i = 0; i < (int)atlasPages.size(); ++i) {
+    atlasPageUC &pg = atlasPages[i];
+    if (pg.dirtyTop >= pg.dirtyBottom && pg.texture.isAllocated())
+      continue;
+    
+    int w = pg.size;
+    int h = pg.size;
+    int channels = pg.channels;
+    GLenum format = channels == 4 ? GL_RGBA : GL_LUMINANCE_ALPHA;
+    GLint internalFormat = format;
+    if (channels == 2 && useTextShaderUC()) {
+      format = GL_RG;
+      internalFormat = GL_RG8;
+    }
+    if (!pg.texture.isAllocated()) {
+      pg.texture.allocate(w, h, internalFormat, false);
+      // color bitmaps are scaled from another size, always filter them
+      if ((bAntiAliased_ && fontSize_>20) || channels == 4) {
+        pg.texture.setTextureMinMagFilter(GL_LINEAR,GL_LINEAR);
+      }
+      else {
+        pg.texture.setTextureMinMagFilter(GL_NEAREST,GL_NEAREST);
+      }
+      if (format == GL_RG) {
+        // sampled as luminance alpha by any shader, the retained text draws with the renderer's
+        const ofTextureData &texData = pg.texture.getTextureData();
+        glBindTexture(texData.textureTarget, texData.textureID);
+        glTexParameteri(texData.textureTarget, GL_TEXTURE_SWIZZLE_R, GL_RED);
+        glTexParameteri(texData.textureTarget, GL_TEXTURE_SWIZZLE_G, GL_RED);
+        glTexParameteri(texData.textureTarget, GL_TEXTURE_SWIZZLE_B, GL_RED);
+        glTexParameteri(texData.textureTarget, GL_TEXTURE_SWIZZLE_A, GL_GREEN);
+      }
+      pg.dirtyTop = 0;
+      pg.dirtyBottom = h;
+    }
+    
+    // a packed page is only uploaded whole, after its texture was unloaded
+    const ofPixels *pixels = &pg.pixels;
+    if (!pg.packed.empty()) {
+      if (unpackedPage_.getWidth() != w || unpackedPage_.getNumChannels() != channels)
+        unpackedPage_.allocate(w, h, channels);
+      unpackPixelsUC(pg.packed, unpackedPage_);
+      pixels = &unpackedPage_;
+    }
+    
+    // only the rows touched since the last upload
+    const ofTextureData &texData = pg.texture.getTextureData();
+    glBindTexture(texData.textureTarget, texData.textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(texData.textureTarget, 0, 0, pg.dirtyTop, w, pg.dirtyBottom - pg.dirtyTop,
+                    format, GL_UNSIGNED_BYTE, pixels->getData() + pg.dirtyTop * w * channels);
+    glBindTexture(texData.textureTarget, 0);
+    
+    pg.dirtyTop = h;
+    pg.dirtyBottom = 0;
+  }
+  
+  if (compactAtlas_)
+    compactPages();
+}
+
+//-----------------------------------------------------------
+// packs the uploaded pages no glyph will be added to, that is
+// all but the page being filled with each kind
+void ofxTrueTypeFontUC::Impl::compactPages() {
+  for (int i = 0; i < (int)atlasPages.size(); ++i) {
+    atlasPageUC &pg = atlasPages[i];
+    if (!pg.packed.empty() || i == fillPage_[pg.channels] || pg.dirtyTop < pg.dirtyBottom || i == defragSource_)
+      continue;
+    TTFUC_TRACE(trace, "compactPage");
+    packPixelsUC(pg.pixels, pg.packed);
+    pg.pixels.clear();
+  }
+  if (unpackedPage_.isAllocated())
+    unpackedPage_.clear();
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::Impl::getNumGlyphTables() {
+  return 1 + phaseCps.size() + effects_.size();
+}
+
+charPropsUC & ofxTrueTypeFontUC::Impl::getTableGlyph(int table, int index) {
+  if (table == 0)
+    return cps[index];
+  if (table <= (int)phaseCps.size())
+    return phaseCps[table - 1][index];
+  return effects_[table - 1 - phaseCps.size()].cps[index];
+}
+
+// the atlas space of glyphs that are thrown away is only counted,
+// it is given back when their pages are defragmented
+void ofxTrueTypeFontUC::Impl::dropGlyphs(const vector<charPropsUC> &glyphs) {
+  for (int i = 0; i < (int)glyphs.size(); ++i) {
+    const charPropsUC &cp = glyphs[i];
+    if (cp.character != kTypefaceUnloaded && cp.page >= 0 && cp.page < (int)atlasPages.size())
+      atlasPages[cp.page].deadPixels += (cp.tW + border_*2) * (cp.tH + border_*2);
+  }
+}
+
+//-----------------------------------------------------------
+// after each draw, so that glyphs only change pages between draws
+void ofxTrueTypeFontUC::Impl::defragmentStep() {
+  if (defragOccupancy_ <= 0 || defragMillis_ <= 0)
+    return;
+  uint64_t frame = ofGetFrameNum();
+  if (frame != defragFrame_) {
+    defragFrame_ = frame;
+    defragFrameMicros_ = 0;
+  }
+  uint64_t budget = defragMillis_ * 1000;
+  if (defragFrameMicros_ >= budget)
+    return;
+  
+  TTFUC_TRACE(trace, "defragment");
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+  uint64_t spent = 0;
+  if (defragSource_ >= 0 || startDefragment()) {
+    // at least one glyph per frame, however small the budget
+    do {
+      moveGlyph(defragNext_++);
+      spent = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime).count();
+    } while (defragNext_ < defragGlyphs_.size() && defragFrameMicros_ + spent < budget);
+    if (defragNext_ == defragGlyphs_.size())
+      commitDefragment();
+  }
+  spent = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime).count();
+  defragFrameMicros_ += spent;
+  statDefragMicros_.fetch_add(spent, memory_order_relaxed);
+}
+
+//-----------------------------------------------------------
+// picks the sparsest coverage page. glyphs are still added to the fill
+// page, color pages are evicted whole, and oversized pages hold a glyph
+// that wouldn't fit anywhere else
+bool ofxTrueTypeFontUC::Impl::startDefragment() {
+  int source = -1;
+  float lowest = defragOccupancy_;
+  for (int i = 0; i < (int)atlasPages.size(); ++i) {
+    const atlasPageUC &pg = atlasPages[i];
+    if (pg.channels != 2 || pg.size != kAtlasPageSize || i == fillPage_[2])
+      continue;
+    float occupancy = float(pg.usedPixels - pg.deadPixels) / float(pg.size * pg.size);
+    if (occupancy < lowest) {
+      lowest = occupancy;
+      source = i;
+    }
+  }
+  if (source < 0)
+    return false;
+  
+  defragGlyphs_.clear();
+  for (int t = 0; t < getNumGlyphTables(); ++t) {
+    for (int i = 0; i < limitCharactersNum_; ++i) {
+      const charPropsUC &cp = getTableGlyph(t, i);
+      if (cp.character != kTypefaceUnloaded && cp.page == source)
+        defragGlyphs_.push_back(make_pair(t, i));
+    }
+  }
+  defragMoved_.resize(defragGlyphs_.size());
+  defragNext_ = 0;
+  defragSource_ = source;
+  
+  // glyphs are copied from the cpu side, which compactPages() leaves alone from now on
+  atlasPageUC &pg = atlasPages[source];
+  if (!pg.packed.empty()) {
+    pg.pixels.allocate(pg.size, pg.size, pg.channels);
+    unpackPixelsUC(pg.packed, pg.pixels);
+    vector<unsigned char>().swap(pg.packed);
+  }
+  return true;
+}
+
+//-----------------------------------------------------------
+// copies the k-th glyph of the source page to the newest page, the
+// glyph itself keeps drawing from the source until the commit
+void ofxTrueTypeFontUC::Impl::moveGlyph(int k) {
+  const charPropsUC &cp = getTableGlyph(defragGlyphs_[k].first, defragGlyphs_[k].second);
+  int width = cp.tW;
+  int height = cp.tH;
+  int page, px, py;
+  allocateAtlasRect(width + border_*2, height + border_*2, 2, page, px, py);
+  const atlasPageUC &src = atlasPages[defragSource_];
+  atlasPageUC &dst = atlasPages[page];
+  
+  int sx = floor(cp.t2 * src.size + 0.5f);
+  int sy = floor(cp.v2 * src.size + 0.5f);
+  for (int y = 0; y < height; ++y) {
+    memcpy(dst.pixels.getData() + ((py + border_ + y) * dst.size + px + border_) * 2,
+           src.pixels.getData() + ((sy + y) * src.size + sx) * 2, width * 2);
+  }
+  dst.dirtyTop = min(dst.dirtyTop, py);
+  dst.dirtyBottom = max(dst.dirtyBottom, py + height + border_*2);
+  
+  charPropsUC &moved = defragMoved_[k];
+  moved.page = page;
+  moved.tW = width;
+  moved.tH = height;
+  moved.t2 = float(px + border_) / float(dst.size);
+  moved.v2 = float(py + border_) / float(dst.size);
+  moved.t1 = float(px + width + border_) / float(dst.size);
+  moved.v1 = float(py + height + border_) / float(dst.size);
+}
+
+//-----------------------------------------------------------
+// every glyph of the source page is copied: point them all to their copies
+// at once and release the page. retained text lays out again
+void ofxTrueTypeFontUC::Impl::commitDefragment() {
+  int source = defragSource_;
+  for (size_t k = 0; k < defragGlyphs_.size(); ++k) {
+    charPropsUC &cp = getTableGlyph(defragGlyphs_[k].first, defragGlyphs_[k].second);
+    const charPropsUC &moved = defragMoved_[k];
+    cp.page = moved.page;
+    cp.t1 = moved.t1;
+    cp.t2 = moved.t2;
+    cp.v1 = moved.v1;
+    cp.v2 = moved.v2;
+  }
+  
+  atlasPages.erase(atlasPages.begin() + source);
+  pageQuads.erase(pageQuads.begin() + source);
+  for (int e = 0; e < (int)effects_.size(); ++e) {
+    if (source < (int)effects_[e].quads.size())
+      effects_[e].quads.erase(effects_[e].quads.begin() + source);
+  }
+  for (int t = 0; t < getNumGlyphTables(); ++t) {
+    for (int i = 0; i < limitCharactersNum_; ++i) {
+      charPropsUC &cp = getTableGlyph(t, i);
+      if (cp.page > source)
+        cp.page--;
+    }
+  }
+  for (int c = 0; c < 5; ++c) {
+    if (fillPage_[c] > source)
+      fillPage_[c]--;
+  }
+  generation_++;
+  
+  statDefragPages_.fetch_add(1, memory_order_relaxed);
+  statDefragGlyphs_.fetch_add(defragGlyphs_.size(), memory_order_relaxed);
+  defragSource_ = -1;
+  defragGlyphs_.clear();
+  defragMoved_.clear();
+}
+
+//-----------------------------------------------------------
+// when the glyph tables change, the copies made so far are dropped
+void ofxTrueTypeFontUC::Impl::cancelDefragment() {
+  if (defragSource_ < 0)
+    return;
+  for (size_t k = 0; k < defragNext_; ++k) {
+    const charPropsUC &moved = defragMoved_[k];
+    if (moved.page < (int)atlasPages.size())
+      atlasPages[moved.page].deadPixels += (moved.tW + border_*2) * (moved.tH + border_*2);
+  }
+  defragSource_ = -1;
+  defragGlyphs_.clear();
+  defragMoved_.clear();
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Impl::loadChar(const int &charID, int phase) {
+  int i = charID;
+  charPropsUC &cp = phase > 0 ? phaseCps[phase - 1][i] : cps[i];
+  ofPixels expandedData;
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+  FT_Face face = getFace(i);
+  TTFUC_TRACE(trace, "loadChar");
+  TTFUC_TRACE(step, "FT_Load_Glyph");
+  
+  //------------------------------------------ anti aliased or not:
+  FT_Error err = FT_Load_Glyph( face, getGlyphIndex(i), getLoadFlags(face) );
+  if(err)
+    ofLog(OF_LOG_ERROR,"ofxTrueTypeFontUC::loadFont - Error with FT_Load_Glyph %i: FT_Error = %d", loadedChars[i], err);
+  
+  // the variants are shifted right by a fraction of a pixel
+  if (phase > 0 && face->glyph->format == FT_GLYPH_FORMAT_OUTLINE)
+    FT_Outline_Translate(&face->glyph->outline, phase * 64 / subpixelPhases_, 0);
+  
+  TTFUC_TRACE_NEXT(step, "FT_Render_Glyph");
+  if (bAntiAliased_ == true)
+    FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
+  else
+    FT_Render_Glyph(face->glyph, FT_RENDER_MODE_MONO);
+  
+  //------------------------------------------
+  FT_Bitmap& bitmap= face->glyph->bitmap;
+  
+  // prepare the texture:
+  /*int width  = ofNextPow2( bitmap.width + border*2 );
+   int height = ofNextPow2( bitmap.rows  + border*2 );
+   
+   
+   // ------------------------- this is fixing a bug with small type
+   // ------------------------- appearantly, opengl has trouble with
+   // ------------------------- width or height textures of 1, so we
+   // ------------------------- we just set it to 2...
+   if (width == 1) width = 2;
+   if (height == 1) height = 2;*/
+  
+  if (bMakeContours_ && phase == 0) {
+    TTFUC_TRACE_NEXT(step, "makeContours");
+    if (printVectorInfo_)
+      printf("\n\ncharacter charID %d: \n", i );
+    
+    charOutlines[i] = makeContoursForCharacter(face);
+    if (simplifyAmt_>0)
+      charOutlines[i].simplify(simplifyAmt_);
+    ofMesh & tessellation = charOutlines[i].getTessellation();
+    outlineBytes_ += tessellation.getNumVertices() * sizeof(ofVec3f) + tessellation.getNumIndices() * sizeof(ofIndexType);
+    vector<ofPolyline> & outlines = charOutlines[i].getOutline();
+    for (int k = 0; k < (int)outlines.size(); ++k)
+      outlineBytes_ += outlines[k].size() * sizeof(ofPoint);
+  }
+  
+  // -------------------------
+  // info about the character:
+  TTFUC_TRACE_NEXT(step, "expandPixels");
+  if (cp.character == kTypefaceUnloaded && phase == 0)
+    residentGlyphs_++;
+  cp.character = loadedChars[i];
+#ifdef FT_LOAD_COLOR
+  cp.color = bitmap.pixel_mode == FT_PIXEL_MODE_BGRA;
+#else
+  cp.color = false;
+#endif
+  cp.height = face->glyph->bitmap_top;
+  cp.width = face->glyph->bitmap.width;
+  // fractional advances, so that long strings don't drift
+  if (subpixelPhases_ > 1)
+    cp.setWidth = face->glyph->linearHoriAdvance / 65536.f;
+  else
+    cp.setWidth = face->glyph->advance.x / 64.f;
+  cp.topExtent = face->glyph->bitmap.rows;
+  cp.leftExtent = face->glyph->bitmap_left;
+  // FreeType synthesizes vertical metrics for faces without them
+  const FT_Glyph_Metrics &metrics = face->glyph->metrics;
+  cp.vertAdvance = metrics.vertAdvance / 64.f;
+  cp.vertOriginX = (metrics.vertBearingX - metrics.horiBearingX) / 64.f;
+  cp.vertOriginY = (metrics.vertBearingY + metrics.horiBearingY) / 64.f;
+  
+  int width = cp.width;
+  int height = bitmap.rows;
+  
+  cp.tW = width;
+  cp.tH = height;
+  
+  GLint fheight = cp.height;
+  GLint bwidth = cp.width;
+  GLint top = cp.topExtent - cp.height;
+  GLint lextent	= cp.leftExtent;
+  
+  GLfloat	corr, stretch;
   
   //this accounts for the fact that we are showing 2*visibleBorder extra pixels
   //so we make the size of each char that many pixels bigger
@@ -1221,10 +4015,18 @@ void ofxTrueTypeFontUC::Impl::loadChar(const int &charID) {
   
   corr	= (float)(((fontSize_ - fheight) + top) - fontSize_);
   
-  cps[i].x1 = lextent + bwidth + stretch;
-  cps[i].y1 = fheight + corr + stretch;
-  cps[i].x2 = (float) lextent;
-  cps[i].y2 = -top + corr;
+  cp.x1 = lextent + bwidth + stretch;
+  cp.y1 = fheight + corr + stretch;
+  cp.x2 = (float) lextent;
+  cp.y2 = -top + corr;
+  
+  if (cp.color) {
+    TTFUC_TRACE_NEXT(step, "packAtlas");
+    loadColorGlyph(cp, face, getBitmapScale(i));
+    statRasterizations_.fetch_add(1, memory_order_relaxed);
+    statRasterizationMicros_.fetch_add(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime).count(), memory_order_relaxed);
+    return;
+  }
   
   // Allocate Memory For The Texture Data.
   expandedData.allocate(width, height, 2);
@@ -1260,40 +4062,2093 @@ void ofxTrueTypeFontUC::Impl::loadChar(const int &charID) {
     //-----------------------------------
   }
   
-  int longSide = border_ * 2;
-  cps[i].tW > cps[i].tH ? longSide += cps[i].tW : longSide += cps[i].tH;
+  TTFUC_TRACE_NEXT(step, "packAtlas");
+  packGlyph(cp, expandedData);
+  
+  statRasterizations_.fetch_add(1, memory_order_relaxed);
+  statRasterizationMicros_.fetch_add(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime).count(), memory_order_relaxed);
+}
+
+
+//=====================================================================
+void ofxTrueTypeFontUC::addOutline(float width, const ofColor &color) {
+  mImpl->addEffect(Impl::kEffectOutline, width, 0, 0, color);
+}
+
+void ofxTrueTypeFontUC::addShadow(float offsetX, float offsetY, float blur, const ofColor &color) {
+  mImpl->addEffect(Impl::kEffectShadow, blur, offsetX, offsetY, color);
+}
+
+void ofxTrueTypeFontUC::addGlow(float radius, const ofColor &color) {
+  mImpl->addEffect(Impl::kEffectGlow, radius, 0, 0, color);
+}
+
+// the baked glyphs stay in the atlas until the font is reloaded,
+// or until setAtlasDefragmentation() moves the glyphs around them
+void ofxTrueTypeFontUC::clearEffects() {
+  mImpl->cancelDefragment();
+  for (int e = 0; e < (int)mImpl->effects_.size(); ++e)
+    mImpl->dropGlyphs(mImpl->effects_[e].cps);
+  mImpl->effects_.clear();
+}
+
+int ofxTrueTypeFontUC::getNumEffects() {
+  return mImpl->effects_.size();
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::setSubpixelPhases(int phases) {
+  phases = min(max(phases, 1), Impl::kMaxSubpixelPhases);
+  if (phases == mImpl->subpixelPhases_)
+    return;
+  mImpl->subpixelPhases_ = phases;
+  // advances and hinting change, so every glyph is loaded again
+  if (mImpl->bLoadedOk_)
+    mImpl->implReserveCharacters(mImpl->limitCharactersNum_);
+}
+
+int ofxTrueTypeFontUC::getSubpixelPhases() {
+  return mImpl->subpixelPhases_;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::setVerticalLayout(bool vertical) {
+  if (mImpl->vertical_ != vertical) {
+    mImpl->vertical_ = vertical;
+    mImpl->generation_++;
+  }
+}
+
+bool ofxTrueTypeFontUC::isVerticalLayout() {
+  return mImpl->vertical_;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::setShapingEnabled(bool enabled) {
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+  if (mImpl->shaping_ != enabled) {
+    mImpl->shaping_ = enabled;
+    mImpl->generation_++;
+  }
+#else
+  if (enabled)
+    ofLogError("ofxTrueTypeFontUC") << "setShapingEnabled(): the addon is built without OFX_TRUETYPEFONTUC_HARFBUZZ";
+#endif
+}
+
+bool ofxTrueTypeFontUC::isShapingEnabled() {
+  return mImpl->shaping_;
+}
+
+void ofxTrueTypeFontUC::setShapingFeatures(const string &features) {
+  if (mImpl->setShapingFeatures(features))
+    mImpl->generation_++;
+}
+
+string ofxTrueTypeFontUC::getShapingFeatures() {
+  return mImpl->shapingFeatures_;
+}
+
+bool ofxTrueTypeFontUC::Impl::setShapingFeatures(const string &features) {
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+  vector<hb_feature_t> parsed;
+  vector<string> names = ofSplitString(features, ",", true, true);
+  for (size_t i = 0; i < names.size(); ++i) {
+    hb_feature_t feature;
+    if (!hb_feature_from_string(names[i].c_str(), -1, &feature)) {
+      ofLogError("ofxTrueTypeFontUC") << "setShapingFeatures(): invalid feature \"" << names[i] << "\"";
+      return false;
+    }
+    parsed.push_back(feature);
+  }
+  hbFeatures_.swap(parsed);
+  shapingFeatures_ = features;
+  shapedRuns_.clear();
+  return true;
+#else
+  shapingFeatures_ = features;
+  return false;
+#endif
+}
+
+//-----------------------------------------------------------
+template<class F> void ofxTrueTypeFontUC::Impl::layoutText(const basic_string<unsigned int> &text, F fn) {
+  if (vertical_) {
+    layoutVertical(text, fn);
+    return;
+  }
+  
+  float X = 0;
+  float Y = 0;
+  size_t begin = 0;
+  while (true) {
+    size_t end = text.find('\n', begin);
+    if (end == basic_string<unsigned int>::npos)
+      end = text.size();
+    
+    const vector<bidiRunUC> &runs = getBidiRuns(text, begin, end);
+    for (size_t r = 0; r < runs.size(); ++r) {
+      size_t runBegin = begin + runs[r].begin;
+      size_t runEnd = begin + runs[r].end;
+      bool rightToLeft = (runs[r].level & 1) != 0;
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+      if (shaping_ && hbFont_ != NULL) {
+        // whole runs, so that the shaper sees the context of every character.
+        // right to left runs come out of it in display order
+        const vector<shapedGlyphUC> &run = shapeRun(text, runBegin, runEnd, rightToLeft ? HB_DIRECTION_RTL : HB_DIRECTION_LTR);
+        for (size_t i = 0; i < run.size(); ++i) {
+          const shapedGlyphUC &glyph = run[i];
+          if (text[runBegin + glyph.cluster] == ' ') {
+            X += getSpaceAdvance();
+            continue;
+          }
+          int cy = getLoadedCharID(kGlyphIndexKey + glyph.index);
+          fn(cy, X + glyph.offsetX, Y - glyph.offsetY, false);
+          X += glyph.advance * letterSpacing_;
+        }
+        continue;
+      }
+#endif
+      for (size_t k = runBegin; k < runEnd; ++k) {
+        unsigned int c = rightToLeft ? getBidiMirror(text[runBegin + runEnd - 1 - k]) : text[k];
+        if (c == ' ') {
+          X += getSpaceAdvance();
+        }
+        else {
+          int cy = getLoadedCharID(c);
+          fn(cy, X, Y, false);
+          X += cps[cy].setWidth * letterSpacing_;
+        }
+      }
+    }
+    
+    fn(-1, X, Y, false);
+    if (end == text.size())
+      break;
+    begin = end + 1;
+    X = 0;
+    Y += lineHeight_;
+  }
+}
+
+//-----------------------------------------------------------
+template<class F> void ofxTrueTypeFontUC::Impl::layoutSpans(const vector<StyleSpan> &spans, F fn) {
+  spanCodes_.clear();
+  spanStyles_.clear();
+  for (size_t s = 0; s < spans.size(); ++s) {
+    int style = (spans[s].style > 0 && spans[s].style <= (int)styles_.size()) ? spans[s].style : 0;
+    spanCodes_ += decode(spans[s].text);
+    spanStyles_.resize(spanCodes_.size(), style);
+  }
+  const basic_string<unsigned int> &text = spanCodes_;
   
-  int tmp = 1;
-  while (longSide > tmp) {
-    tmp <<= 1;
+  float X = 0;
+  float Y = 0;
+  size_t begin = 0;
+  while (true) {
+    size_t end = text.find('\n', begin);
+    if (end == basic_string<unsigned int>::npos)
+      end = text.size();
+    
+    // as high as its tallest style, or the style of the line break on empty lines
+    float lineHeight = getStyleLineHeight(end < text.size() ? spanStyles_[end] : 0);
+    if (begin < end)
+      lineHeight = 0;
+    const vector<bidiRunUC> &runs = getBidiRuns(text, begin, end);
+    for (size_t r = 0; r < runs.size(); ++r) {
+      size_t runBegin = begin + runs[r].begin;
+      size_t runEnd = begin + runs[r].end;
+      bool rightToLeft = (runs[r].level & 1) != 0;
+      for (size_t k = runBegin; k < runEnd; ++k) {
+        size_t i = rightToLeft ? runBegin + runEnd - 1 - k : k;
+        int style = spanStyles_[i];
+        lineHeight = max(lineHeight, getStyleLineHeight(style));
+        unsigned int c = rightToLeft ? getBidiMirror(text[i]) : text[i];
+        if (c == ' ') {
+          X += getSpaceAdvance(style);
+        }
+        else {
+          int cy = getLoadedCharID(getStyleKey(style, c));
+          fn(cy, X, Y, false);
+          X += cps[cy].setWidth * letterSpacing_;
+        }
+      }
+    }
+    
+    fn(-1, X, Y, false);
+    if (end == text.size())
+      break;
+    begin = end + 1;
+    X = 0;
+    Y += lineHeight;
+  }
+}
+
+//-----------------------------------------------------------
+template<class F> void ofxTrueTypeFontUC::Impl::layoutVertical(const basic_string<unsigned int> &text, F fn) {
+  // upright glyphs hang from the pen on the center line of the column,
+  // turned ones sit on a baseline that centers them in it
+  float baseline = getTurnedBaseline();
+  float X = 0;
+  float Y = 0;
+  size_t begin = 0;
+  while (true) {
+    size_t end = text.find('\n', begin);
+    if (end == basic_string<unsigned int>::npos)
+      end = text.size();
+    
+    size_t i = begin;
+    while (i < end) {
+      if (text[i] == ' ') {
+        Y += getSpaceAdvance();
+        ++i;
+        continue;
+      }
+      bool upright = isUpright(text[i]);
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+      if (shaping_ && hbFont_ != NULL) {
+        // runs of either kind, upright ones shaped top to bottom for the vert feature
+        size_t runEnd = i + 1;
+        while (runEnd < end && text[runEnd] != ' ' && isUpright(text[runEnd]) == upright)
+          ++runEnd;
+        const vector<shapedGlyphUC> &run = shapeRun(text, i, runEnd, upright ? HB_DIRECTION_TTB : HB_DIRECTION_LTR);
+        for (size_t g = 0; g < run.size(); ++g) {
+          const shapedGlyphUC &glyph = run[g];
+          int cy = getLoadedCharID(kGlyphIndexKey + glyph.index);
+          if (upright)
+            fn(cy, X + glyph.offsetX, Y - glyph.offsetY, false);
+          else
+            fn(cy, X + baseline + glyph.offsetY, Y + glyph.offsetX, true);
+          Y += glyph.advance * letterSpacing_;
+        }
+        i = runEnd;
+        continue;
+      }
+#endif
+      if (upright) {
+        int cy = getVerticalCharID(text[i]);
+        fn(cy, X + cps[cy].vertOriginX, Y + cps[cy].vertOriginY, false);
+        Y += cps[cy].vertAdvance * letterSpacing_;
+      }
+      else {
+        int cy = getLoadedCharID(text[i]);
+        fn(cy, X + baseline, Y, true);
+        Y += cps[cy].setWidth * letterSpacing_;
+      }
+      ++i;
+    }
+    
+    fn(-1, X, Y, false);
+    if (end == text.size())
+      break;
+    begin = end + 1;
+    X -= lineHeight_;
+    Y = 0;
+  }
+}
+
+// the vertical form of punctuation if the face has it
+int ofxTrueTypeFontUC::Impl::getVerticalCharID(unsigned int c) {
+  unsigned int form = getVerticalForm(c);
+  if (form != c) {
+    int cy = getCharID(form);
+    if (getGlyphIndex(cy) != 0)
+      return useGlyph(cy);
+  }
+  return getLoadedCharID(c);
+}
+
+//-----------------------------------------------------------
+const vector<bidiRunUC> & ofxTrueTypeFontUC::Impl::getBidiRuns(const basic_string<unsigned int> &text, size_t begin, size_t end) {
+  if (!hasRightToLeft(text.data() + begin, end - begin)) {
+    leftToRightRun_.resize(1);
+    leftToRightRun_[0].begin = 0;
+    leftToRightRun_[0].end = end - begin;
+    leftToRightRun_[0].level = 0;
+    return leftToRightRun_;
   }
-  int w = tmp;
-  int h = w;
   
-  ofPixels atlasPixels;
-  atlasPixels.allocate(w,h,2);
-  atlasPixels.set(0,255);
-  atlasPixels.set(1,0);
+  bidiLine_.assign(text, begin, end - begin);
+  vector<bidiRunUC> *cached = bidiRuns_.find(bidiLine_);
+  if (cached != NULL)
+    return *cached;
+  
+  TTFUC_TRACE(trace, "bidi");
+  vector<bidiRunUC> &runs = bidiRuns_.insert(bidiLine_);
+  resolveBidiLevels(bidiLine_.data(), bidiLine_.size(), bidiLevels_);
+  reorderBidiRuns(bidiLevels_.data(), bidiLevels_.size(), runs);
+  return runs;
+}
+
+#ifdef OFX_TRUETYPEFONTUC_HARFBUZZ
+//-----------------------------------------------------------
+const vector<shapedGlyphUC> & ofxTrueTypeFontUC::Impl::shapeRun(const basic_string<unsigned int> &text, size_t begin, size_t end, hb_direction_t direction) {
+  basic_string<unsigned int> key(text, begin, end - begin);
+  if (direction != HB_DIRECTION_LTR)
+    key.push_back(kGlyphIndexKey + direction);
+  vector<shapedGlyphUC> *cached = shapedRuns_.find(key);
+  if (cached != NULL) {
+    statShapeHits_.fetch_add(1, memory_order_relaxed);
+    return *cached;
+  }
   
-  cps[i].t2 = float(border_) / float(w);
-  cps[i].v2 = float(border_) / float(h);
-  cps[i].t1 = float(cps[i].tW + border_) / float(w);
-  cps[i].v1 = float(cps[i].tH + border_) / float(h);
-  expandedData.pasteInto(atlasPixels, border_, border_);
+  TTFUC_TRACE(trace, "shape");
+  statShapeMisses_.fetch_add(1, memory_order_relaxed);
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
   
-  textures[i].allocate(atlasPixels.getWidth(), atlasPixels.getHeight(), GL_LUMINANCE_ALPHA, false);
+  hb_buffer_clear_contents(hbBuffer_);
+  hb_buffer_add_utf32(hbBuffer_, (const uint32_t *)text.data() + begin, end - begin, 0, end - begin);
+  hb_buffer_set_direction(hbBuffer_, direction);
+  hb_buffer_guess_segment_properties(hbBuffer_);
+  hb_shape(hbFont_, hbBuffer_, hbFeatures_.empty() ? NULL : &hbFeatures_[0], hbFeatures_.size());
   
-  if (bAntiAliased_ && fontSize_>20) {
-    textures[i].setTextureMinMagFilter(GL_LINEAR,GL_LINEAR);
+  unsigned int count;
+  const hb_glyph_info_t *infos = hb_buffer_get_glyph_infos(hbBuffer_, &count);
+  const hb_glyph_position_t *positions = hb_buffer_get_glyph_positions(hbBuffer_, &count);
+  vector<shapedGlyphUC> &run = shapedRuns_.insert(key);
+  run.resize(count);
+  for (unsigned int i = 0; i < count; ++i) {
+    run[i].index = infos[i].codepoint;
+    run[i].cluster = infos[i].cluster;
+    // down the column for top to bottom runs, whose offsets are from the horizontal origin
+    run[i].advance = (direction == HB_DIRECTION_TTB ? -positions[i].y_advance : positions[i].x_advance) / 64.f * bitmapScale_;
+    run[i].offsetX = positions[i].x_offset / 64.f * bitmapScale_;
+    run[i].offsetY = positions[i].y_offset / 64.f * bitmapScale_;
   }
-  else {
-    textures[i].setTextureMinMagFilter(GL_NEAREST,GL_NEAREST);
+  statShapingMicros_.fetch_add(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime).count(),
+                               memory_order_relaxed);
+  return run;
+}
+#endif
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::setColorPageLimit(int pages) {
+  mImpl->colorPageLimit_ = max(pages, 1);
+}
+
+int ofxTrueTypeFontUC::getColorPageLimit() {
+  return mImpl->colorPageLimit_;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Impl::addEffect(int type, float size, float offsetX, float offsetY, const ofColor &color) {
+  cancelDefragment();
+  effects_.push_back(effectUC());
+  effectUC &effect = effects_.back();
+  effect.type = type;
+  effect.size = max(size, 0.f);
+  effect.offsetX = offsetX;
+  effect.offsetY = offsetY;
+  effect.color = color;
+  
+  charPropsUC unloaded;
+  unloaded.character = kTypefaceUnloaded;
+  effect.cps.assign(cps.size(), unloaded);
+  effect.quads.resize(atlasPages.size());
+  for (int i = 0; i < (int)effect.quads.size(); ++i)
+    effect.quads[i].setMode(OF_PRIMITIVE_TRIANGLES);
+}
+
+//-----------------------------------------------------------
+const charPropsUC & ofxTrueTypeFontUC::Impl::getEffectGlyph(int effect, int charID) {
+  if (effects_[effect].cps[charID].character == kTypefaceUnloaded)
+    loadEffectGlyph(effect, charID);
+  return effects_[effect].cps[charID];
+}
+
+//-----------------------------------------------------------
+// 8 bit coverage of a FreeType bitmap, gray or mono
+static void getCoverage(const FT_Bitmap &bitmap, int pad, vector<unsigned char> &coverage) {
+  int w = bitmap.width + pad*2;
+  int h = bitmap.rows + pad*2;
+  coverage.assign(w * h, 0);
+  for (int y = 0; y < (int)bitmap.rows; ++y) {
+    const unsigned char *src = bitmap.buffer + y * bitmap.pitch;
+    unsigned char *dst = &coverage[(y + pad) * w + pad];
+    if (bitmap.pixel_mode == FT_PIXEL_MODE_MONO) {
+      for (int x = 0; x < (int)bitmap.width; ++x)
+        dst[x] = (src[x >> 3] & (0x80 >> (x & 7))) ? 255 : 0;
+    }
+    else
+      memcpy(dst, src, bitmap.width);
   }
-	
-  #if (OF_VERSION_MAJOR == 0 && OF_VERSION_MINOR >= 9 && OF_VERSION_PATCH >= 2) || OF_VERSION_MAJOR > 0
-	textures[i].loadData(atlasPixels.getData(), atlasPixels.getWidth(), atlasPixels.getHeight(), GL_LUMINANCE_ALPHA);
-  #else
-	textures[i].loadData(atlasPixels.getPixels(), atlasPixels.getWidth(), atlasPixels.getHeight(), GL_LUMINANCE_ALPHA);
-  #endif
 }
 
+// dst = src blurred along columns, the inner loops run along rows
+// with fixed point weights, so that compilers vectorize them
+static void blurColumns(const unsigned char *src, unsigned char *dst, int w, int h, const vector<uint32_t> &kernel) {
+  int r = kernel.size() / 2;
+  vector<uint32_t> sum(w);
+  for (int y = 0; y < h; ++y) {
+    fill(sum.begin(), sum.end(), 1 << 15);
+    for (int k = max(-r, -y); k <= r && y + k < h; ++k) {
+      const unsigned char *row = src + (y + k) * w;
+      uint32_t weight = kernel[k + r];
+      for (int x = 0; x < w; ++x)
+        sum[x] += row[x] * weight;
+    }
+    unsigned char *out = dst + y * w;
+    for (int x = 0; x < w; ++x)
+      out[x] = sum[x] >> 16;
+  }
+}
+
+static void transpose(const unsigned char *src, unsigned char *dst, int w, int h) {
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x)
+      dst[x * h + y] = src[y * w + x];
+  }
+}
+
+// separable gaussian, radius is where the kernel is cut at 3 sigma
+static void blurCoverage(vector<unsigned char> &coverage, int w, int h, float radius) {
+  int r = ceil(radius);
+  if (r <= 0 || coverage.empty())
+    return;
+  
+  float sigma = radius / 3.f;
+  vector<float> weights(r*2 + 1);
+  float total = 0;
+  for (int k = -r; k <= r; ++k) {
+    weights[k + r] = exp(-(k*k) / (2.f * sigma*sigma));
+    total += weights[k + r];
+  }
+  // weights sum to exactly 1 << 16
+  vector<uint32_t> kernel(r*2 + 1);
+  uint32_t used = 0;
+  for (int k = 0; k < r*2 + 1; ++k) {
+    kernel[k] = weights[k] / total * 65536.f;
+    used += kernel[k];
+  }
+  kernel[r] += 65536 - used;
+  
+  vector<unsigned char> tmp(coverage.size());
+  blurColumns(&coverage[0], &tmp[0], w, h, kernel);
+  transpose(&tmp[0], &coverage[0], w, h);
+  blurColumns(&coverage[0], &tmp[0], h, w, kernel);
+  transpose(&tmp[0], &coverage[0], h, w);
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Impl::loadEffectGlyph(int e, int charID) {
+  TTFUC_TRACE(trace, "loadEffectGlyph");
+  effectUC &effect = effects_[e];
+  charPropsUC &cp = effect.cps[charID];
+  cp = cps[charID];
+  cp.character = loadedChars[charID];
+  cp.color = false;
+  FT_Face face = getFace(charID);
+  
+  // color glyphs have no effects, they get an empty bitmap
+  FT_Error err = cps[charID].color ? 1 : FT_Load_Glyph(face, getGlyphIndex(charID), getLoadFlags(face));
+  if (err && !cps[charID].color)
+    ofLogError("ofxTrueTypeFontUC") << "loadEffectGlyph(): FT_Load_Glyph " << loadedChars[charID] << " failed: FT_Error = " << err;
+  FT_Render_Mode mode = bAntiAliased_ ? FT_RENDER_MODE_NORMAL : FT_RENDER_MODE_MONO;
+  
+  vector<unsigned char> coverage;
+  int width = 0;
+  int height = 0;
+  int left = 0;
+  int top = 0;
+  
+  if (effect.type == kEffectOutline) {
+    // stroke the outline on both sides, the glyph covers the inner half
+    FT_Glyph glyph;
+    if (!err && face->glyph->format == FT_GLYPH_FORMAT_OUTLINE && FT_Get_Glyph(face->glyph, &glyph) == 0) {
+      FT_Stroker stroker;
+      FT_Stroker_New(library_, &stroker);
+      FT_Stroker_Set(stroker, (FT_Fixed)(effect.size * 64), FT_STROKER_LINECAP_ROUND, FT_STROKER_LINEJOIN_ROUND, 0);
+      if (FT_Glyph_Stroke(&glyph, stroker, 1) == 0 && FT_Glyph_To_Bitmap(&glyph, mode, NULL, 1) == 0) {
+        FT_BitmapGlyph bitmapGlyph = (FT_BitmapGlyph)glyph;
+        getCoverage(bitmapGlyph->bitmap, 0, coverage);
+        width = bitmapGlyph->bitmap.width;
+        height = bitmapGlyph->bitmap.rows;
+        left = bitmapGlyph->left;
+        top = bitmapGlyph->top;
+      }
+      FT_Stroker_Done(stroker);
+      FT_Done_Glyph(glyph);
+    }
+  }
+  else {
+    // shadows and glows are the blurred glyph, padded by the blur radius
+    int pad = ceil(effect.size);
+    if (!err && FT_Render_Glyph(face->glyph, mode) == 0) {
+      const FT_Bitmap &bitmap = face->glyph->bitmap;
+      getCoverage(bitmap, pad, coverage);
+      width = bitmap.width + pad*2;
+      height = bitmap.rows + pad*2;
+      left = face->glyph->bitmap_left - pad;
+      top = face->glyph->bitmap_top + pad;
+      blurCoverage(coverage, width, height, effect.size);
+      if (effect.type == kEffectGlow) {
+        for (int k = 0; k < (int)coverage.size(); ++k)
+          coverage[k] = min(coverage[k] * 2, 255);
+      }
+    }
+  }
+  
+  // same placement as loadChar(), relative to the pen position
+  cp.tW = width;
+  cp.tH = height;
+  cp.x1 = left + width;
+  cp.x2 = left;
+  cp.y1 = height - top;
+  cp.y2 = -top;
+  
+  ofPixels pixels;
+  pixels.allocate(width, height, 2);
+  pixels.set(0,255);
+  if (width > 0 && height > 0) {
+    ofPixels alpha;
+    alpha.setFromExternalPixels(&coverage[0], width, height, 1);
+    pixels.setChannel(1, alpha);
+  }
+  packGlyph(cp, pixels);
+}
+
+//=====================================================================
+class ofxTrueTypeFontUC::MutableText::Impl {
+public:
+  Impl() :font(NULL), generation(0), textDirty(false), vboCapacity(0), dirtyBegin(0), dirtyEnd(0), indicesDirty(true) {};
+  
+  ofxTrueTypeFontUC *font;
+  unsigned int generation;
+  
+  string text;
+  bool textDirty;  // text is encoded from codes when asked for, after insert() and erase()
+  basic_string<unsigned int> codes;
+  vector<int> charIDs;  // -1 for characters without a quad
+  // origin of each character, plus the end of the text. these are the
+  // prefix sums of the advances, sorted by line and then by x in each line
+  vector<ofVec2f> pens;
+  
+  // 4 vertices per character, holes are degenerate quads
+  vector<ofVec3f> vertices;
+  vector<ofVec2f> texCoords;
+  vector<ofIndexType> indices;
+  vector<int> pageStarts;
+  vector<int> pageCounts;
+  
+  ofVbo vbo;
+  int vboCapacity;
+  int dirtyBegin, dirtyEnd;  // characters not uploaded yet
+  bool indicesDirty;
+  
+  bool isReady();
+  bool refresh();
+  const string & getText();
+  void update(const basic_string<unsigned int> &newCodes);
+  void splice(int begin, int end, const basic_string<unsigned int> &inserted);
+  void edit(int begin, int end, const basic_string<unsigned int> &inserted);
+  int getLineEnd(int index);
+  void layout(int begin, int end, ofVec2f pen);
+  void writeQuads(int begin, int end);
+  void buildIndices();
+  void upload();
+};
+
+//-----------------------------------------------------------
+ofxTrueTypeFontUC::MutableText::MutableText() {
+  mImpl = new Impl();
+}
+
+ofxTrueTypeFontUC::MutableText::MutableText(ofxTrueTypeFontUC &font) {
+  mImpl = new Impl();
+  setFont(font);
+}
+
+ofxTrueTypeFontUC::MutableText::~MutableText() {
+  if (mImpl != NULL)
+    delete mImpl;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::setFont(ofxTrueTypeFontUC &font) {
+  mImpl->font = &font;
+  mImpl->generation = font.mImpl->generation_ - 1;
+}
+
+//-----------------------------------------------------------
+const string & ofxTrueTypeFontUC::MutableText::getText() {
+  return mImpl->getText();
+}
+
+const string & ofxTrueTypeFontUC::MutableText::Impl::getText() {
+  if (textDirty) {
+    text = convFromUTF32(codes);
+    textDirty = false;
+  }
+  return text;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::setText(const string &str) {
+  if (str == mImpl->getText())
+    return;
+  mImpl->text = str;
+  if (mImpl->isReady())
+    mImpl->update(mImpl->font->mImpl->decode(str));
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::insert(int index, const string &str) {
+  basic_string<unsigned int> inserted = mImpl->font != NULL ? mImpl->font->mImpl->decode(str) : convToUTF32(str);
+  index = min(max(index, 0), getNumCharacters());
+  mImpl->edit(index, index, inserted);
+}
+
+void ofxTrueTypeFontUC::MutableText::erase(int index, int count) {
+  int size = getNumCharacters();
+  index = min(max(index, 0), size);
+  count = min(max(count, 0), size - index);
+  if (count > 0)
+    mImpl->edit(index, index + count, basic_string<unsigned int>());
+}
+
+// replaces the characters [begin, end) without decoding or laying out the rest
+void ofxTrueTypeFontUC::MutableText::Impl::edit(int begin, int end, const basic_string<unsigned int> &inserted) {
+  if (refresh()) {
+    splice(begin, end, inserted);
+    textDirty = true;
+  }
+  else {
+    // nothing is laid out yet, edit the text itself
+    basic_string<unsigned int> all = convToUTF32(getText());
+    all.replace(begin, end - begin, inserted);
+    text = convFromUTF32(all);
+  }
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::MutableText::getNumCharacters() {
+  if (mImpl->refresh())
+    return mImpl->codes.size();
+  return convToUTF32(mImpl->getText()).size();
+}
+
+//-----------------------------------------------------------
+ofPoint ofxTrueTypeFontUC::MutableText::getCaretPosition(int index) {
+  if (!mImpl->refresh())
+    return ofPoint();
+  const ofVec2f &pen = mImpl->pens[min(max(index, 0), (int)mImpl->codes.size())];
+  return ofPoint(pen.x, pen.y);
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::MutableText::getIndexAt(float x, float y) {
+  if (!mImpl->refresh())
+    return 0;
+  ofxTrueTypeFontUC::Impl *fontImpl = mImpl->font->mImpl;
+  const vector<ofVec2f> &pens = mImpl->pens;
+  
+  // the first line whose box reaches below y, or the last line
+  float below = fontImpl->lineHeight_ - fontImpl->getAscender();
+  vector<ofVec2f>::const_iterator line = upper_bound(pens.begin(), pens.end(), y,
+    [below](float y, const ofVec2f &pen) { return y < pen.y + below; });
+  if (line == pens.end())
+    --line;
+  int first = lower_bound(pens.begin(), line, line->y,
+    [](const ofVec2f &pen, float y) { return pen.y < y; }) - pens.begin();
+  int last = mImpl->getLineEnd(first);
+  
+  // the nearest caret position in it
+  int index = lower_bound(pens.begin() + first, pens.begin() + last, x,
+    [](const ofVec2f &pen, float x) { return pen.x < x; }) - pens.begin();
+  if (index > first && x - pens[index - 1].x < pens[index].x - x)
+    index--;
+  return index;
+}
+
+//-----------------------------------------------------------
+vector<ofRectangle> ofxTrueTypeFontUC::MutableText::getSelectionRectangles(int begin, int end) {
+  vector<ofRectangle> rects;
+  if (!mImpl->refresh())
+    return rects;
+  ofxTrueTypeFontUC::Impl *fontImpl = mImpl->font->mImpl;
+  const vector<ofVec2f> &pens = mImpl->pens;
+  int size = mImpl->codes.size();
+  begin = min(max(begin, 0), size);
+  end = min(max(end, 0), size);
+  if (begin > end)
+    swap(begin, end);
+  
+  // one rectangle per line, selected line breaks are shown as a space
+  float ascender = fontImpl->getAscender();
+  while (begin < end) {
+    int last = mImpl->getLineEnd(begin);
+    float right = pens[min(end, last)].x;
+    if (end > last)
+      right += fontImpl->getSpaceAdvance();
+    rects.push_back(ofRectangle(pens[begin].x, pens[begin].y - ascender, right - pens[begin].x, fontImpl->lineHeight_));
+    begin = last + 1;
+  }
+  return rects;
+}
+
+//-----------------------------------------------------------
+bool ofxTrueTypeFontUC::MutableText::Impl::isReady() {
+  return font != NULL && font->mImpl->bLoadedOk_;
+}
+
+// lays the text out again when the font changed, false without a font
+bool ofxTrueTypeFontUC::MutableText::Impl::refresh() {
+  if (!isReady())
+    return false;
+  if (generation != font->mImpl->generation_) {
+    // glyphs or metrics changed, lay out everything again
+    update(font->mImpl->decode(getText()));
+  }
+  return true;
+}
+
+// the last caret position on the line of index, at its line break or the end
+int ofxTrueTypeFontUC::MutableText::Impl::getLineEnd(int index) {
+  return upper_bound(pens.begin() + index, pens.end(), pens[index].y,
+    [](float y, const ofVec2f &pen) { return y < pen.y; }) - pens.begin() - 1;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::draw(float x, float y) {
+  if (!mImpl->refresh()) {
+    ofLogError("ofxTrueTypeFontUC") << "MutableText::draw(): font not allocated";
+    return;
+  }
+  ofxTrueTypeFontUC::Impl *fontImpl = mImpl->font->mImpl;
+  if (mImpl->codes.empty())
+    return;
+  
+  fontImpl->uploadDirtyPages();
+  mImpl->upload();
+  
+  ofPushMatrix();
+  ofTranslate(x, y);
+  fontImpl->bind();
+  for (int i = 0; i < (int)mImpl->pageCounts.size(); ++i) {
+    if (mImpl->pageCounts[i] == 0)
+      continue;
+    fontImpl->atlasPages[i].texture.bind();
+    mImpl->vbo.drawElements(GL_TRIANGLES, mImpl->pageCounts[i], mImpl->pageStarts[i]);
+    fontImpl->countDraw(mImpl->pageCounts[i] / 6);
+    fontImpl->atlasPages[i].texture.unbind();
+  }
+  fontImpl->unbind();
+  fontImpl->defragmentStep();
+  ofPopMatrix();
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::Impl::update(const basic_string<unsigned int> &newCodes) {
+  ofxTrueTypeFontUC::Impl *fontImpl = font->mImpl;
+  if (generation != fontImpl->generation_) {
+    codes.clear();
+    charIDs.clear();
+    pens.assign(1, ofVec2f(0,0));
+    generation = fontImpl->generation_;
+    indicesDirty = true;
+    // the context may have been lost too, allocate the vbo again
+    vboCapacity = 0;
+    vbo.clear();
+  }
+  
+  // find the changed range [prefix, size - suffix) of both strings
+  int oldLen = codes.size();
+  int newLen = newCodes.size();
+  int prefix = 0;
+  while (prefix < oldLen && prefix < newLen && codes[prefix] == newCodes[prefix])
+    prefix++;
+  int suffix = 0;
+  while (suffix < oldLen - prefix && suffix < newLen - prefix &&
+         codes[oldLen - 1 - suffix] == newCodes[newLen - 1 - suffix])
+    suffix++;
+  splice(prefix, oldLen - suffix, newCodes.substr(prefix, newLen - suffix - prefix));
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::Impl::splice(int prefix, int oldEnd, const basic_string<unsigned int> &inserted) {
+  ofxTrueTypeFontUC::Impl *fontImpl = font->mImpl;
+  int oldLen = codes.size();
+  int newLen = oldLen - (oldEnd - prefix) + inserted.size();
+  int newEnd = prefix + inserted.size();
+  
+  vector<int> oldPages;
+  for (int i = prefix; i < oldEnd; ++i)
+    oldPages.push_back(charIDs[i] < 0 ? -1 : fontImpl->cps[charIDs[i]].page);
+  ofVec2f oldSuffixPen = pens[oldEnd];
+  
+  // splice the changed characters in
+  codes.replace(prefix, oldEnd - prefix, inserted);
+  charIDs.erase(charIDs.begin() + prefix, charIDs.begin() + oldEnd);
+  charIDs.insert(charIDs.begin() + prefix, newEnd - prefix, -1);
+  pens.erase(pens.begin() + prefix + 1, pens.begin() + oldEnd + 1);
+  pens.insert(pens.begin() + prefix + 1, newEnd - prefix, ofVec2f());
+  layout(prefix, newEnd, pens[prefix]);
+  
+  // the unchanged tail moves with the end of the changed range,
+  // horizontally up to its first line break, vertically everywhere
+  float dx = pens[newEnd].x - oldSuffixPen.x;
+  float dy = pens[newEnd].y - oldSuffixPen.y;
+  bool moved = (dx != 0 || dy != 0);
+  if (moved) {
+    bool sameLine = true;
+    for (int i = newEnd + 1; i <= newLen; ++i) {
+      if (codes[i - 1] == '\n')
+        sameLine = false;
+      // the rest of the line is given the exact same y, the queries find lines by it
+      pens[i].x += sameLine ? dx : 0;
+      pens[i].y = sameLine ? pens[newEnd].y : pens[i].y + dy;
+    }
+  }
+  
+  // quads to rewrite: the whole tail when it moved in the buffer or on screen
+  int rewriteEnd = (oldLen != newLen || moved) ? max(oldLen, newLen) : newEnd;
+  if (rewriteEnd > vboCapacity) {
+    vboCapacity = max(rewriteEnd, vboCapacity * 2);
+    vertices.resize(vboCapacity * 4);
+    texCoords.resize(vboCapacity * 4);
+  }
+  writeQuads(prefix, rewriteEnd);
+  
+  if (oldLen != newLen)
+    indicesDirty = true;
+  for (int i = prefix; i < newEnd && !indicesDirty; ++i) {
+    int page = charIDs[i] < 0 ? -1 : fontImpl->cps[charIDs[i]].page;
+    if (page != oldPages[i - prefix])
+      indicesDirty = true;
+  }
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::Impl::layout(int begin, int end, ofVec2f pen) {
+  ofxTrueTypeFontUC::Impl *fontImpl = font->mImpl;
+  for (int i = begin; i < end; ++i) {
+    unsigned int c = codes[i];
+    pens[i] = pen;
+    if (c == '\n') {
+      charIDs[i] = -1;
+      pen.set(0, pen.y + fontImpl->lineHeight_);
+    }
+    else if (c == ' ') {
+      charIDs[i] = -1;
+      pen.x += fontImpl->getSpaceAdvance();
+    }
+    else {
+      int cy = fontImpl->getLoadedCharID(c);
+      charIDs[i] = cy;
+      pen.x += fontImpl->cps[cy].setWidth * fontImpl->letterSpacing_;
+    }
+  }
+  pens[end] = pen;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::Impl::writeQuads(int begin, int end) {
+  ofxTrueTypeFontUC::Impl *fontImpl = font->mImpl;
+  for (int i = begin; i < end; ++i) {
+    if (i < (int)charIDs.size() && charIDs[i] >= 0) {
+      fontImpl->getGlyphQuad(charIDs[i], pens[i].x, pens[i].y, &vertices[i*4], &texCoords[i*4]);
+    }
+    else {
+      for (int j = 0; j < 4; ++j) {
+        vertices[i*4+j].set(0,0,0);
+        texCoords[i*4+j].set(0,0);
+      }
+    }
+  }
+  
+  if (dirtyBegin >= dirtyEnd) {
+    dirtyBegin = begin;
+    dirtyEnd = end;
+  }
+  else {
+    dirtyBegin = min(dirtyBegin, begin);
+    dirtyEnd = max(dirtyEnd, end);
+  }
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::Impl::buildIndices() {
+  // group the quads by atlas page, one draw call each
+  int numPages = font->mImpl->atlasPages.size();
+  pageStarts.assign(numPages, 0);
+  pageCounts.assign(numPages, 0);
+  for (int i = 0; i < (int)charIDs.size(); ++i) {
+    if (charIDs[i] >= 0)
+      pageCounts[font->mImpl->cps[charIDs[i]].page] += 6;
+  }
+  for (int p = 1; p < numPages; ++p)
+    pageStarts[p] = pageStarts[p-1] + pageCounts[p-1];
+  
+  vector<int> cursor = pageStarts;
+  indices.resize(pageStarts.empty() ? 0 : pageStarts.back() + pageCounts.back());
+  for (int i = 0; i < (int)charIDs.size(); ++i) {
+    if (charIDs[i] < 0)
+      continue;
+    ofIndexType firstIndex = i * 4;
+    ofIndexType *quad = &indices[cursor[font->mImpl->cps[charIDs[i]].page]];
+    quad[0] = firstIndex;
+    quad[1] = firstIndex+1;
+    quad[2] = firstIndex+2;
+    quad[3] = firstIndex+2;
+    quad[4] = firstIndex+3;
+    quad[5] = firstIndex;
+    cursor[font->mImpl->cps[charIDs[i]].page] += 6;
+  }
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::MutableText::Impl::upload() {
+  if (indicesDirty) {
+    buildIndices();
+    if (!indices.empty())
+      vbo.setIndexData(&indices[0], indices.size(), GL_DYNAMIC_DRAW);
+    indicesDirty = false;
+  }
+  
+  int allocated = vbo.getIsAllocated() ? vbo.getNumVertices() / 4 : 0;
+  if (allocated < vboCapacity) {
+    vbo.setVertexData(&vertices[0], vertices.size(), GL_DYNAMIC_DRAW);
+    vbo.setTexCoordData(&texCoords[0], texCoords.size(), GL_DYNAMIC_DRAW);
+  }
+  else if (dirtyBegin < dirtyEnd) {
+    // only the characters that changed since the last draw
+    int first = dirtyBegin * 4;
+    int count = (dirtyEnd - dirtyBegin) * 4;
+    vbo.getVertexBuffer().updateData(first * sizeof(ofVec3f), count * sizeof(ofVec3f), &vertices[first]);
+    vbo.getTexCoordBuffer().updateData(first * sizeof(ofVec2f), count * sizeof(ofVec2f), &texCoords[first]);
+  }
+  dirtyBegin = dirtyEnd = 0;
+}
+
+//=====================================================================
+class ofxTrueTypeFontUC::TextBlock::Impl {
+public:
+  Impl() :font(NULL), generation(0) {};
+  
+  ofxTrueTypeFontUC *font;
+  unsigned int generation;
+  
+  string text;
+  vector<size_t> lineStarts;  // byte offset of each line, plus the end of the text
+  vector<float> lineTops;  // cumulative height above each line, plus the total
+  string lineBuffer;
+  
+  void buildLineTops();
+};
+
+//-----------------------------------------------------------
+ofxTrueTypeFontUC::TextBlock::TextBlock() {
+  mImpl = new Impl();
+  mImpl->lineStarts.assign(2, 0);
+}
+
+ofxTrueTypeFontUC::TextBlock::TextBlock(ofxTrueTypeFontUC &font) {
+  mImpl = new Impl();
+  mImpl->lineStarts.assign(2, 0);
+  setFont(font);
+}
+
+ofxTrueTypeFontUC::TextBlock::~TextBlock() {
+  if (mImpl != NULL)
+    delete mImpl;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::TextBlock::setFont(ofxTrueTypeFontUC &font) {
+  mImpl->font = &font;
+  mImpl->generation = font.mImpl->generation_ - 1;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::TextBlock::setText(const string &str) {
+  mImpl->text = str;
+  
+  // index the line starts once, drawing decodes visible lines only
+  mImpl->lineStarts.clear();
+  mImpl->lineStarts.push_back(0);
+  size_t pos = 0;
+  while ((pos = str.find('\n', pos)) != string::npos)
+    mImpl->lineStarts.push_back(++pos);
+  mImpl->lineStarts.push_back(str.size() + 1);
+  
+  if (mImpl->font != NULL)
+    mImpl->generation = mImpl->font->mImpl->generation_ - 1;
+}
+
+//-----------------------------------------------------------
+const string & ofxTrueTypeFontUC::TextBlock::getText() {
+  return mImpl->text;
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::TextBlock::getNumLines() {
+  return mImpl->lineStarts.size() - 1;
+}
+
+//-----------------------------------------------------------
+float ofxTrueTypeFontUC::TextBlock::getHeight() {
+  if (mImpl->font == NULL)
+    return 0;
+  mImpl->buildLineTops();
+  return mImpl->lineTops.back();
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::TextBlock::Impl::buildLineTops() {
+  if (generation == font->mImpl->generation_)
+    return;
+  
+  int numLines = lineStarts.size() - 1;
+  lineTops.resize(numLines + 1);
+  lineTops[0] = 0;
+  for (int i = 0; i < numLines; ++i)
+    lineTops[i+1] = lineTops[i] + font->mImpl->lineHeight_;
+  generation = font->mImpl->generation_;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::TextBlock::draw(float x, float y) {
+  draw(x, y, ofRectangle(-FLT_MAX/2, -FLT_MAX/2, FLT_MAX, FLT_MAX));
+}
+
+void ofxTrueTypeFontUC::TextBlock::draw(float x, float y, const ofRectangle &clip) {
+  if (mImpl->font == NULL || !mImpl->font->mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "TextBlock::draw(): font not allocated";
+    return;
+  }
+  ofxTrueTypeFontUC::Impl *fontImpl = mImpl->font->mImpl;
+  mImpl->buildLineTops();
+  
+  // y is the baseline of the first line, as in drawString(), and a line
+  // may reach up to one line height above and below its baseline.
+  // vertical lines are columns to the left of x instead
+  const vector<float> &tops = mImpl->lineTops;
+  float lineHeight = fontImpl->lineHeight_;
+  bool vertical = fontImpl->vertical_;
+  float clipTop = (vertical ? x - clip.getRight() : clip.getTop() - y) - lineHeight;
+  float clipBottom = (vertical ? x - clip.getLeft() : clip.getBottom() - y) + lineHeight;
+  int numLines = tops.size() - 1;
+  int first = upper_bound(tops.begin(), tops.end() - 1, clipTop) - tops.begin();
+  int last = lower_bound(tops.begin() + first, tops.end() - 1, clipBottom) - tops.begin();
+  last = min(last, numLines);
+  
+  for (int i = first; i < last; ++i) {
+    size_t begin = mImpl->lineStarts[i];
+    size_t end = mImpl->lineStarts[i+1] - 1;
+    if (end <= begin)
+      continue;
+    mImpl->lineBuffer.assign(mImpl->text, begin, end - begin);
+    if (vertical)
+      fontImpl->addStringQuads(fontImpl->decode(mImpl->lineBuffer), x - tops[i], y);
+    else
+      fontImpl->addStringQuads(fontImpl->decode(mImpl->lineBuffer), x, y + tops[i]);
+  }
+  fontImpl->drawPageQuads();
+}
+
+//=====================================================================
+class ofxTrueTypeFontUC::Console::Impl {
+public:
+  Impl() :font(NULL), generation(0), maxLines(1000), firstLine(0), numLines(0),
+          scroll(0), quadCapacity(0), quadHead(0), groupFirstVisible(0), groupVisibleLines(0),
+          vboCapacity(0), indicesDirty(true) {};
+  
+  ofxTrueTypeFontUC *font;
+  unsigned int generation;
+  
+  // ring of lines, line n lives in slot n % maxLines
+  int maxLines;
+  long long firstLine;
+  int numLines;
+  vector<string> lineTexts;
+  vector<int> lineQuadStarts;
+  vector<int> lineQuadCounts;
+  float scroll;
+  
+  // ring of quads, each line is a contiguous range of it
+  int quadCapacity;
+  int quadHead;
+  vector<ofVec3f> vertices;
+  vector<ofVec2f> texCoords;
+  vector<int> quadPages;
+  vector<pair<int, int> > dirtyRanges;  // quads not uploaded yet
+  
+  // visible quads grouped by wrap segment and page
+  vector<ofIndexType> indices;
+  vector<int> groupStarts;
+  vector<int> groupCounts;
+  int groupFirstVisible;
+  int groupVisibleLines;
+  
+  ofVbo vbo;
+  int vboCapacity;
+  bool indicesDirty;
+  
+  void reset();
+  void relayout();
+  void appendLine(const string &line);
+  bool placeQuads(int count, int &start);
+  void growQuads(int count);
+  void markDirty(int begin, int end);
+  void buildIndices(long long first, int count);
+  void upload();
+};
+
+//-----------------------------------------------------------
+ofxTrueTypeFontUC::Console::Console() {
+  mImpl = new Impl();
+  mImpl->reset();
+}
+
+ofxTrueTypeFontUC::Console::Console(ofxTrueTypeFontUC &font, int maxLines) {
+  mImpl = new Impl();
+  mImpl->maxLines = max(maxLines, 1);
+  mImpl->reset();
+  setFont(font);
+}
+
+ofxTrueTypeFontUC::Console::~Console() {
+  if (mImpl != NULL)
+    delete mImpl;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::setFont(ofxTrueTypeFontUC &font) {
+  mImpl->font = &font;
+  mImpl->generation = font.mImpl->generation_ - 1;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::setMaxLines(int maxLines) {
+  maxLines = max(maxLines, 1);
+  if (maxLines == mImpl->maxLines)
+    return;
+  
+  // keep the newest lines that still fit
+  vector<string> lines;
+  for (long long n = max(mImpl->firstLine, mImpl->firstLine + mImpl->numLines - maxLines); n < mImpl->firstLine + mImpl->numLines; ++n)
+    lines.push_back(mImpl->lineTexts[n % mImpl->maxLines]);
+  mImpl->maxLines = maxLines;
+  mImpl->reset();
+  for (int i = 0; i < (int)lines.size(); ++i)
+    mImpl->appendLine(lines[i]);
+}
+
+int ofxTrueTypeFontUC::Console::getMaxLines() {
+  return mImpl->maxLines;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::addLine(const string &line) {
+  size_t begin = 0;
+  size_t end;
+  while ((end = line.find('\n', begin)) != string::npos) {
+    mImpl->appendLine(line.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  mImpl->appendLine(begin == 0 ? line : line.substr(begin));
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::clear() {
+  mImpl->reset();
+}
+
+int ofxTrueTypeFontUC::Console::getNumLines() {
+  return mImpl->numLines;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::setScroll(float lines) {
+  mImpl->scroll = max(lines, 0.f);
+}
+
+float ofxTrueTypeFontUC::Console::getScroll() {
+  return mImpl->scroll;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::Impl::reset() {
+  firstLine = 0;
+  numLines = 0;
+  lineTexts.assign(maxLines, string());
+  lineQuadStarts.assign(maxLines, 0);
+  lineQuadCounts.assign(maxLines, 0);
+  quadHead = 0;
+  dirtyRanges.clear();
+  indicesDirty = true;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::Impl::relayout() {
+  // glyphs or metrics changed, lay out the history again
+  generation = font->mImpl->generation_;
+  vector<string> lines;
+  for (long long n = firstLine; n < firstLine + numLines; ++n)
+    lines.push_back(lineTexts[n % maxLines]);
+  reset();
+  // the context may have been lost too, allocate the vbo again
+  vboCapacity = 0;
+  vbo.clear();
+  for (int i = 0; i < (int)lines.size(); ++i)
+    appendLine(lines[i]);
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::Impl::appendLine(const string &line) {
+  if (font == NULL || !font->mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "Console::addLine(): font not allocated";
+    return;
+  }
+  ofxTrueTypeFontUC::Impl *fontImpl = font->mImpl;
+  if (generation != fontImpl->generation_)
+    relayout();
+  
+  if (numLines == maxLines) {
+    firstLine++;
+    numLines--;
+  }
+  if (numLines == 0)
+    quadHead = 0;
+  
+  long long n = firstLine + numLines;
+  int slot = n % maxLines;
+  basic_string<unsigned int> codes = fontImpl->decode(line);
+  
+  int count = 0;
+  for (size_t i = 0; i < codes.size(); ++i) {
+    if (codes[i] != ' ')
+      count++;
+  }
+  int start;
+  if (!placeQuads(count, start)) {
+    growQuads(count);
+    placeQuads(count, start);
+  }
+  
+  // baselines are relative to the slot, so they stay small forever
+  float X = 0;
+  float Y = slot * fontImpl->lineHeight_;
+  int q = start;
+  for (size_t i = 0; i < codes.size(); ++i) {
+    if (codes[i] == ' ') {
+      X += fontImpl->getSpaceAdvance();
+      continue;
+    }
+    int cy = fontImpl->getLoadedCharID(codes[i]);
+    fontImpl->getGlyphQuad(cy, X, Y, &vertices[q*4], &texCoords[q*4]);
+    quadPages[q] = fontImpl->cps[cy].page;
+    X += fontImpl->cps[cy].setWidth * fontImpl->letterSpacing_;
+    q++;
+  }
+  markDirty(start, start + count);
+  
+  lineTexts[slot] = line;
+  lineQuadStarts[slot] = start;
+  lineQuadCounts[slot] = count;
+  numLines++;
+  quadHead = start + count;
+  indicesDirty = true;
+}
+
+//-----------------------------------------------------------
+bool ofxTrueTypeFontUC::Console::Impl::placeQuads(int count, int &start) {
+  if (numLines == 0) {
+    start = 0;
+    return count <= quadCapacity;
+  }
+  
+  // live quads run from the oldest line to the head, maybe wrapping around
+  int tail = lineQuadStarts[firstLine % maxLines];
+  if (quadHead >= tail) {
+    if (quadHead + count <= quadCapacity) {
+      start = quadHead;
+      return true;
+    }
+    if (count < tail) {
+      start = 0;
+      return true;
+    }
+    return false;
+  }
+  if (quadHead + count < tail) {
+    start = quadHead;
+    return true;
+  }
+  return false;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::Impl::growQuads(int count) {
+  int capacity = max(max(quadCapacity * 2, quadCapacity + count), maxLines * 8);
+  
+  // repack the live lines from the start of the new ring
+  vector<ofVec3f> newVertices(capacity * 4);
+  vector<ofVec2f> newTexCoords(capacity * 4);
+  vector<int> newPages(capacity, 0);
+  int head = 0;
+  for (long long n = firstLine; n < firstLine + numLines; ++n) {
+    int slot = n % maxLines;
+    int start = lineQuadStarts[slot];
+    int num = lineQuadCounts[slot];
+    copy(vertices.begin() + start*4, vertices.begin() + (start + num)*4, newVertices.begin() + head*4);
+    copy(texCoords.begin() + start*4, texCoords.begin() + (start + num)*4, newTexCoords.begin() + head*4);
+    copy(quadPages.begin() + start, quadPages.begin() + start + num, newPages.begin() + head);
+    lineQuadStarts[slot] = head;
+    head += num;
+  }
+  vertices.swap(newVertices);
+  texCoords.swap(newTexCoords);
+  quadPages.swap(newPages);
+  quadCapacity = capacity;
+  quadHead = head;
+  dirtyRanges.clear();
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::Impl::markDirty(int begin, int end) {
+  if (begin >= end)
+    return;
+  if (!dirtyRanges.empty() && dirtyRanges.back().second == begin)
+    dirtyRanges.back().second = end;
+  else
+    dirtyRanges.push_back(make_pair(begin, end));
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::Impl::buildIndices(long long first, int count) {
+  // lines after the wrap of the line ring are drawn with a second offset
+  int numPages = font->mImpl->atlasPages.size();
+  int firstSlot = first % maxLines;
+  groupStarts.assign(numPages * 2, 0);
+  groupCounts.assign(numPages * 2, 0);
+  for (long long n = first; n < first + count; ++n) {
+    int slot = n % maxLines;
+    int group = (slot < firstSlot) ? numPages : 0;
+    for (int q = lineQuadStarts[slot]; q < lineQuadStarts[slot] + lineQuadCounts[slot]; ++q)
+      groupCounts[group + quadPages[q]] += 6;
+  }
+  for (int g = 1; g < numPages * 2; ++g)
+    groupStarts[g] = groupStarts[g-1] + groupCounts[g-1];
+  indices.resize(groupStarts.empty() ? 0 : groupStarts.back() + groupCounts.back());
+  
+  vector<int> cursor = groupStarts;
+  for (long long n = first; n < first + count; ++n) {
+    int slot = n % maxLines;
+    int group = (slot < firstSlot) ? numPages : 0;
+    for (int q = lineQuadStarts[slot]; q < lineQuadStarts[slot] + lineQuadCounts[slot]; ++q) {
+      ofIndexType firstIndex = q * 4;
+      ofIndexType *quad = &indices[cursor[group + quadPages[q]]];
+      quad[0] = firstIndex;
+      quad[1] = firstIndex+1;
+      quad[2] = firstIndex+2;
+      quad[3] = firstIndex+2;
+      quad[4] = firstIndex+3;
+      quad[5] = firstIndex;
+      cursor[group + quadPages[q]] += 6;
+    }
+  }
+  groupFirstVisible = firstSlot;
+  groupVisibleLines = count;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::Impl::upload() {
+  if (vboCapacity < quadCapacity) {
+    vbo.setVertexData(&vertices[0], vertices.size(), GL_DYNAMIC_DRAW);
+    vbo.setTexCoordData(&texCoords[0], texCoords.size(), GL_DYNAMIC_DRAW);
+    vboCapacity = quadCapacity;
+  }
+  else {
+    for (int i = 0; i < (int)dirtyRanges.size(); ++i) {
+      int first = dirtyRanges[i].first * 4;
+      int count = (dirtyRanges[i].second - dirtyRanges[i].first) * 4;
+      vbo.getVertexBuffer().updateData(first * sizeof(ofVec3f), count * sizeof(ofVec3f), &vertices[first]);
+      vbo.getTexCoordBuffer().updateData(first * sizeof(ofVec2f), count * sizeof(ofVec2f), &texCoords[first]);
+    }
+  }
+  dirtyRanges.clear();
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Console::draw(float x, float y, int visibleLines) {
+  if (mImpl->font == NULL || !mImpl->font->mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "Console::draw(): font not allocated";
+    return;
+  }
+  ofxTrueTypeFontUC::Impl *fontImpl = mImpl->font->mImpl;
+  if (mImpl->generation != fontImpl->generation_)
+    mImpl->relayout();
+  if (mImpl->numLines == 0 || visibleLines <= 0)
+    return;
+  
+  // the newest line minus the scroll ends the view, the
+  // fraction of the scroll is part of the uniform offset
+  long long end = mImpl->firstLine + mImpl->numLines;
+  float scroll = min(mImpl->scroll, (float)max(mImpl->numLines - visibleLines, 0));
+  long long last = end - (long long)floor(scroll);
+  long long first = max(mImpl->firstLine, end - visibleLines - (long long)ceil(scroll));
+  int count = last - first;
+  int firstSlot = first % mImpl->maxLines;
+  if (mImpl->indicesDirty || firstSlot != mImpl->groupFirstVisible || count != mImpl->groupVisibleLines) {
+    mImpl->buildIndices(first, count);
+    if (!mImpl->indices.empty())
+      mImpl->vbo.setIndexData(&mImpl->indices[0], mImpl->indices.size(), GL_DYNAMIC_DRAW);
+    mImpl->indicesDirty = false;
+  }
+  
+  fontImpl->uploadDirtyPages();
+  mImpl->upload();
+  
+  float lineHeight = fontImpl->lineHeight_;
+  float top = y + (first - firstSlot - end + visibleLines + scroll) * lineHeight;
+  int numPages = fontImpl->atlasPages.size();
+  fontImpl->bind();
+  for (int g = 0; g < (int)mImpl->groupCounts.size(); ++g) {
+    if (mImpl->groupCounts[g] == 0)
+      continue;
+    ofPushMatrix();
+    ofTranslate(x, top + (g >= numPages ? mImpl->maxLines * lineHeight : 0));
+    fontImpl->atlasPages[g % numPages].texture.bind();
+    mImpl->vbo.drawElements(GL_TRIANGLES, mImpl->groupCounts[g], mImpl->groupStarts[g]);
+    fontImpl->countDraw(mImpl->groupCounts[g] / 6);
+    fontImpl->atlasPages[g % numPages].texture.unbind();
+    ofPopMatrix();
+  }
+  fontImpl->unbind();
+  fontImpl->defragmentStep();
+}
+
+//=====================================================================
+// line breaking classes, a small subset of UAX #14 with the
+// Japanese kinsoku rules folded into CL (no line start) and OP (no line end)
+enum lineBreakClassUC {
+  kBreakAL,  // letters, digits and everything else
+  kBreakBK,  // mandatory break
+  kBreakSP,  // space
+  kBreakID,  // ideographs, kana, fullwidth forms
+  kBreakOP,  // opening punctuation
+  kBreakCL,  // closing punctuation and other line start prohibited characters
+  kBreakHY,  // hyphen
+};
+
+static lineBreakClassUC getLineBreakClass(unsigned int c) {
+  if (c == '\n')
+    return kBreakBK;
+  if (c == ' ' || c == '\t' || c == 0x3000)
+    return kBreakSP;
+  if (c == '-')
+    return kBreakHY;
+  
+  static const unsigned int closing[] = {
+    '!', '%', ')', ',', '.', ':', ';', '?', ']', '}', 0x00bb, 0x2019, 0x201d, 0x2025, 0x2026, 0x3001,
+    0x3002, 0x3005, 0x3009, 0x300b, 0x300d, 0x300f, 0x3011, 0x3015, 0x3017, 0x3019, 0x301f, 0x303b,
+    0x3041, 0x3043, 0x3045, 0x3047, 0x3049, 0x3063, 0x3083, 0x3085, 0x3087, 0x308e, 0x3095, 0x3096,
+    0x309b, 0x309c, 0x309d, 0x309e, 0x30a0, 0x30a1, 0x30a3, 0x30a5, 0x30a7, 0x30a9, 0x30c3, 0x30e3,
+    0x30e5, 0x30e7, 0x30ee, 0x30f5, 0x30f6, 0x30fb, 0x30fc, 0x30fd, 0x30fe, 0x31f0, 0x31f1, 0x31f2,
+    0x31f3, 0x31f4, 0x31f5, 0x31f6, 0x31f7, 0x31f8, 0x31f9, 0x31fa, 0x31fb, 0x31fc, 0x31fd, 0x31fe,
+    0x31ff, 0xff01, 0xff09, 0xff0c, 0xff0e, 0xff1a, 0xff1b, 0xff1f, 0xff3d, 0xff5d, 0xff60, 0xff61,
+    0xff63, 0xff64,
+  };
+  static const unsigned int opening[] = {
+    '(', '[', '{', 0x00ab, 0x2018, 0x201c, 0x3008, 0x300a, 0x300c, 0x300e, 0x3010, 0x3014, 0x3016,
+    0x3018, 0x301d, 0xff08, 0xff3b, 0xff5b, 0xff5f, 0xff62,
+  };
+  // both tables are sorted
+  if (binary_search(closing, closing + sizeof(closing) / sizeof(closing[0]), c))
+    return kBreakCL;
+  if (binary_search(opening, opening + sizeof(opening) / sizeof(opening[0]), c))
+    return kBreakOP;
+  
+  if ((c >= 0x2e80 && c <= 0x9fff) ||  // CJK radicals, kana, ideographs
+      (c >= 0xac00 && c <= 0xd7af) ||  // hangul
+      (c >= 0xf900 && c <= 0xfaff) ||  // compatibility ideographs
+      (c >= 0xff00 && c <= 0xffef) ||  // fullwidth forms
+      (c >= 0x1f000 && c <= 0x1faff) ||  // emoji
+      (c >= 0x20000 && c <= 0x3ffff))  // ideographs extensions
+    return kBreakID;
+  return kBreakAL;
+}
+
+// whether a line may break between two characters of the given classes
+static bool canBreakBetween(lineBreakClassUC before, lineBreakClassUC after) {
+  if (after == kBreakSP || after == kBreakCL)
+    return false;
+  if (before == kBreakOP)
+    return false;
+  if (before == kBreakSP)
+    return true;
+  if (before == kBreakHY && after == kBreakAL)
+    return true;
+  return before == kBreakID || after == kBreakID || after == kBreakOP;
+}
+
+//=====================================================================
+class ofxTrueTypeFontUC::Paragraph::Impl {
+public:
+  Impl() :font(NULL), generation(0), maxWidth(0), alignment(OF_ALIGN_HORZ_LEFT),
+          lineSpacing(1), wrapped(false) {};
+  
+  ofxTrueTypeFontUC *font;
+  unsigned int generation;
+  
+  string text;
+  basic_string<unsigned int> codes;
+  vector<bool> breakBefore;  // a line may start at this character
+  vector<unsigned char> bidiLevels;  // empty when all of the text is left to right
+  vector<int> charIDs;  // -1 for characters without a quad
+  vector<float> prefix;  // sum of the advances before each character
+  
+  float maxWidth;
+  ofAlignHorz alignment;
+  float lineSpacing;
+  
+  // wrapped lines as [begin, end) of codes, and their visible width
+  vector<int> lineStarts;
+  vector<int> lineEnds;
+  vector<float> lineWidths;
+  vector<vector<bidiRunUC> > lineRuns;  // display order, with bidiLevels only
+  bool wrapped;
+  
+  void measure();
+  void wrap();
+  void endLine(int begin, int end);
+  void update();
+};
+
+//-----------------------------------------------------------
+ofxTrueTypeFontUC::Paragraph::Paragraph() {
+  mImpl = new Impl();
+}
+
+ofxTrueTypeFontUC::Paragraph::Paragraph(ofxTrueTypeFontUC &font) {
+  mImpl = new Impl();
+  setFont(font);
+}
+
+ofxTrueTypeFontUC::Paragraph::~Paragraph() {
+  if (mImpl != NULL)
+    delete mImpl;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::setFont(ofxTrueTypeFontUC &font) {
+  mImpl->font = &font;
+  mImpl->generation = font.mImpl->generation_ - 1;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::setText(const string &str) {
+  mImpl->text = str;
+  mImpl->codes = mImpl->font != NULL ? mImpl->font->mImpl->decode(str) : convToUTF32(str);
+  
+  // break opportunities only depend on the characters
+  int len = mImpl->codes.size();
+  mImpl->breakBefore.assign(len, false);
+  for (int i = 1; i < len; ++i)
+    mImpl->breakBefore[i] = canBreakBetween(getLineBreakClass(mImpl->codes[i-1]), getLineBreakClass(mImpl->codes[i]));
+  
+  // and so do the bidirectional levels, resolved for each line of the text
+  // and reordered for each wrapped line
+  mImpl->bidiLevels.clear();
+  if (hasRightToLeft(mImpl->codes.data(), len)) {
+    mImpl->bidiLevels.resize(len);
+    vector<unsigned char> levels;
+    for (size_t begin = 0; begin < (size_t)len; ) {
+      size_t end = mImpl->codes.find('\n', begin);
+      if (end == basic_string<unsigned int>::npos)
+        end = len;
+      resolveBidiLevels(mImpl->codes.data() + begin, end - begin, levels);
+      copy(levels.begin(), levels.end(), mImpl->bidiLevels.begin() + begin);
+      begin = end + 1;
+    }
+  }
+  
+  if (mImpl->font != NULL)
+    mImpl->generation = mImpl->font->mImpl->generation_ - 1;
+}
+
+const string & ofxTrueTypeFontUC::Paragraph::getText() {
+  return mImpl->text;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::setMaxWidth(float width) {
+  if (width != mImpl->maxWidth)
+    mImpl->wrapped = false;
+  mImpl->maxWidth = width;
+}
+
+float ofxTrueTypeFontUC::Paragraph::getMaxWidth() {
+  return mImpl->maxWidth;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::setAlignment(ofAlignHorz alignment) {
+  mImpl->alignment = alignment;
+}
+
+ofAlignHorz ofxTrueTypeFontUC::Paragraph::getAlignment() {
+  return mImpl->alignment;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::setLineSpacing(float spacing) {
+  mImpl->lineSpacing = spacing;
+}
+
+float ofxTrueTypeFontUC::Paragraph::getLineSpacing() {
+  return mImpl->lineSpacing;
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::Paragraph::getNumLines() {
+  mImpl->update();
+  return mImpl->lineStarts.size();
+}
+
+float ofxTrueTypeFontUC::Paragraph::getWidth() {
+  mImpl->update();
+  float width = 0;
+  for (int i = 0; i < (int)mImpl->lineWidths.size(); ++i)
+    width = max(width, mImpl->lineWidths[i]);
+  return width;
+}
+
+float ofxTrueTypeFontUC::Paragraph::getHeight() {
+  mImpl->update();
+  if (mImpl->font == NULL)
+    return 0;
+  return mImpl->lineStarts.size() * mImpl->font->mImpl->lineHeight_ * mImpl->lineSpacing;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::Impl::update() {
+  if (font == NULL || !font->mImpl->bLoadedOk_)
+    return;
+  if (generation != font->mImpl->generation_) {
+    measure();
+    generation = font->mImpl->generation_;
+    wrapped = false;
+  }
+  if (!wrapped) {
+    wrap();
+    wrapped = true;
+  }
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::Impl::measure() {
+  ofxTrueTypeFontUC::Impl *fontImpl = font->mImpl;
+  int len = codes.size();
+  charIDs.assign(len, -1);
+  prefix.resize(len + 1);
+  prefix[0] = 0;
+  
+  float spaceAdvance = fontImpl->getSpaceAdvance();
+  for (int i = 0; i < len; ++i) {
+    float advance = 0;
+    if (codes[i] == ' ') {
+      advance = spaceAdvance;
+    }
+    else if (codes[i] != '\n') {
+      int cy = fontImpl->getLoadedCharID(codes[i]);
+      charIDs[i] = cy;
+      advance = fontImpl->cps[cy].setWidth * fontImpl->letterSpacing_;
+    }
+    prefix[i+1] = prefix[i] + advance;
+  }
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::Impl::endLine(int begin, int end) {
+  // trailing spaces hang past the edge and aren't part of the width
+  int last = end;
+  while (last > begin && getLineBreakClass(codes[last-1]) == kBreakSP)
+    last--;
+  lineStarts.push_back(begin);
+  lineEnds.push_back(end);
+  lineWidths.push_back(prefix[last] - prefix[begin]);
+  
+  if (!bidiLevels.empty()) {
+    lineRuns.push_back(vector<bidiRunUC>());
+    vector<bidiRunUC> &runs = lineRuns.back();
+    reorderBidiRuns(bidiLevels.data() + begin, last - begin, runs);
+    for (size_t r = 0; r < runs.size(); ++r) {
+      runs[r].begin += begin;
+      runs[r].end += begin;
+    }
+  }
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::Impl::wrap() {
+  lineStarts.clear();
+  lineEnds.clear();
+  lineWidths.clear();
+  lineRuns.clear();
+  
+  // greedy, every character is visited at most twice
+  int len = codes.size();
+  int begin = 0;
+  int lastBreak = -1;
+  int i = 0;
+  while (i < len) {
+    if (codes[i] == '\n') {
+      endLine(begin, i);
+      begin = i + 1;
+      lastBreak = -1;
+      i++;
+      continue;
+    }
+    if (i > begin && breakBefore[i])
+      lastBreak = i;
+    
+    bool overflows = maxWidth > 0 && i > begin && charIDs[i] >= 0 &&
+                     prefix[i+1] - prefix[begin] > maxWidth;
+    if (overflows) {
+      // go back to the last opportunity, or cut a word longer than the line
+      int end = (lastBreak > begin) ? lastBreak : i;
+      endLine(begin, end);
+      begin = end;
+      lastBreak = -1;
+      i = end;
+      continue;
+    }
+    i++;
+  }
+  endLine(begin, len);
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::Paragraph::draw(float x, float y) {
+  if (mImpl->font == NULL || !mImpl->font->mImpl->bLoadedOk_) {
+    ofLogError("ofxTrueTypeFontUC") << "Paragraph::draw(): font not allocated";
+    return;
+  }
+  mImpl->update();
+  ofxTrueTypeFontUC::Impl *fontImpl = mImpl->font->mImpl;
+  
+  float boxWidth = mImpl->maxWidth > 0 ? mImpl->maxWidth : getWidth();
+  float lineHeight = fontImpl->lineHeight_ * mImpl->lineSpacing;
+  for (int l = 0; l < (int)mImpl->lineStarts.size(); ++l) {
+    float X = x;
+    if (mImpl->alignment == OF_ALIGN_HORZ_RIGHT)
+      X += boxWidth - mImpl->lineWidths[l];
+    else if (mImpl->alignment == OF_ALIGN_HORZ_CENTER)
+      X += (boxWidth - mImpl->lineWidths[l]) * 0.5f;
+    float Y = y + l * lineHeight;
+    
+    int begin = mImpl->lineStarts[l];
+    if (mImpl->lineRuns.empty()) {
+      for (int i = begin; i < mImpl->lineEnds[l]; ++i) {
+        if (mImpl->charIDs[i] >= 0)
+          fontImpl->drawChar(mImpl->charIDs[i], X + mImpl->prefix[i] - mImpl->prefix[begin], Y);
+      }
+      continue;
+    }
+    
+    // right to left runs are drawn from their last character, mirrored
+    const vector<bidiRunUC> &runs = mImpl->lineRuns[l];
+    for (size_t r = 0; r < runs.size(); ++r) {
+      bool rightToLeft = (runs[r].level & 1) != 0;
+      for (int k = runs[r].begin; k < runs[r].end; ++k) {
+        int i = rightToLeft ? runs[r].begin + runs[r].end - 1 - k : k;
+        int cy = mImpl->charIDs[i];
+        if (cy >= 0) {
+          unsigned int mirrored = rightToLeft ? getBidiMirror(mImpl->codes[i]) : mImpl->codes[i];
+          if (mirrored != mImpl->codes[i])
+            cy = fontImpl->getLoadedCharID(mirrored);
+          fontImpl->drawChar(cy, X, Y);
+        }
+        X += mImpl->prefix[i+1] - mImpl->prefix[i];
+      }
+    }
+  }
+  fontImpl->drawPageQuads();
+}
+
+//=====================================================================
+class ofxTrueTypeFontUC::AnimatedText::Impl {
+public:
+  Impl() :font(NULL), generation(0), layoutDirty(true), attributesDirty(true), shaderLayout(false) {};
+  
+  ofxTrueTypeFontUC *font;
+  unsigned int generation;
+  
+  string text;
+  vector<GlyphAttributes> attributes;
+  
+  // laid out once for each text and font
+  vector<int> charIDs;
+  vector<ofVec2f> origins;  // pen position of each glyph
+  vector<ofVec2f> centers;  // of each quad, scale and rotation are around it
+  vector<ofVec3f> corners;  // 4 per glyph, relative to its center
+  vector<ofVec2f> texCoords;
+  vector<ofIndexType> indices;
+  vector<int> pageStarts;
+  vector<int> pageCounts;
+  
+  // the attributes of each glyph repeated for its 4 vertices, either
+  // as the transform of the shader or transformed on the cpu
+  vector<float> transforms;
+  vector<ofVec3f> vertices;
+  vector<ofFloatColor> colors;
+  
+  ofVbo vbo;
+  bool layoutDirty;  // quads not uploaded yet
+  bool attributesDirty;
+  bool shaderLayout;  // whether the vbo holds corners and transforms
+  
+  bool refresh();
+  void layout();
+  void buildIndices();
+  void expandAttributes(bool shader);
+  void upload(bool shader);
+};
+
+//-----------------------------------------------------------
+ofxTrueTypeFontUC::AnimatedText::AnimatedText() {
+  mImpl = new Impl();
+}
+
+ofxTrueTypeFontUC::AnimatedText::AnimatedText(ofxTrueTypeFontUC &font) {
+  mImpl = new Impl();
+  setFont(font);
+}
+
+ofxTrueTypeFontUC::AnimatedText::~AnimatedText() {
+  if (mImpl != NULL)
+    delete mImpl;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::AnimatedText::setFont(ofxTrueTypeFontUC &font) {
+  mImpl->font = &font;
+  mImpl->generation = font.mImpl->generation_ - 1;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::AnimatedText::setText(const string &str) {
+  if (str == mImpl->text)
+    return;
+  mImpl->text = str;
+  if (mImpl->font != NULL)
+    mImpl->generation = mImpl->font->mImpl->generation_ - 1;
+}
+
+const string & ofxTrueTypeFontUC::AnimatedText::getText() {
+  return mImpl->text;
+}
+
+//-----------------------------------------------------------
+int ofxTrueTypeFontUC::AnimatedText::getNumGlyphs() {
+  if (!mImpl->refresh())
+    return 0;
+  return mImpl->charIDs.size();
+}
+
+ofPoint ofxTrueTypeFontUC::AnimatedText::getGlyphPosition(int index) {
+  if (!mImpl->refresh() || index < 0 || index >= (int)mImpl->origins.size())
+    return ofPoint();
+  return ofPoint(mImpl->origins[index].x, mImpl->origins[index].y);
+}
+
+//-----------------------------------------------------------
+vector<ofxTrueTypeFontUC::AnimatedText::GlyphAttributes> & ofxTrueTypeFontUC::AnimatedText::getAttributes() {
+  mImpl->refresh();
+  mImpl->attributesDirty = true;
+  return mImpl->attributes;
+}
+
+void ofxTrueTypeFontUC::AnimatedText::resetAttributes() {
+  mImpl->refresh();
+  mImpl->attributes.assign(mImpl->attributes.size(), GlyphAttributes());
+  mImpl->attributesDirty = true;
+}
+
+//-----------------------------------------------------------
+// lays the text out again when it or the font changed, false without a font
+bool ofxTrueTypeFontUC::AnimatedText::Impl::refresh() {
+  if (font == NULL || !font->mImpl->bLoadedOk_)
+    return false;
+  if (generation != font->mImpl->generation_)
+    layout();
+  return true;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::AnimatedText::Impl::layout() {
+  ofxTrueTypeFontUC::Impl *fontImpl = font->mImpl;
+  generation = fontImpl->generation_;
+  
+  charIDs.clear();
+  origins.clear();
+  vector<bool> turns;
+  fontImpl->layoutText(fontImpl->decode(text), [&](int cy, float x, float y, bool turned) {
+    if (cy < 0)
+      return;
+    charIDs.push_back(cy);
+    origins.push_back(ofVec2f(x, y));
+    turns.push_back(turned);
+  });
+  
+  int n = charIDs.size();
+  centers.resize(n);
+  corners.resize(n * 4);
+  texCoords.resize(n * 4);
+  for (int i = 0; i < n; ++i) {
+    ofVec3f *quad = &corners[i*4];
+    fontImpl->getGlyphQuad(charIDs[i], 0, 0, quad, &texCoords[i*4]);
+    if (turns[i])
+      turnQuad(quad, 0, 0);
+    float cx = (quad[0].x + quad[2].x) * 0.5f;
+    float cy = (quad[0].y + quad[2].y) * 0.5f;
+    for (int j = 0; j < 4; ++j) {
+      quad[j].x -= cx;
+      quad[j].y -= cy;
+    }
+    centers[i].set(origins[i].x + cx, origins[i].y + cy);
+  }
+  buildIndices();
+  
+  attributes.resize(n);
+  transforms.resize(n * 16);
+  vertices.resize(n * 4);
+  colors.resize(n * 4);
+  layoutDirty = true;
+  attributesDirty = true;
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::AnimatedText::Impl::buildIndices() {
+  // group the quads by atlas page, one draw call each
+  int numPages = font->mImpl->atlasPages.size();
+  pageStarts.assign(numPages, 0);
+  pageCounts.assign(numPages, 0);
+  for (int i = 0; i < (int)charIDs.size(); ++i)
+    pageCounts[font->mImpl->cps[charIDs[i]].page] += 6;
+  for (int p = 1; p < numPages; ++p)
+    pageStarts[p] = pageStarts[p-1] + pageCounts[p-1];
+  
+  vector<int> cursor = pageStarts;
+  indices.resize(charIDs.size() * 6);
+  for (int i = 0; i < (int)charIDs.size(); ++i) {
+    ofIndexType firstIndex = i * 4;
+    ofIndexType *quad = &indices[cursor[font->mImpl->cps[charIDs[i]].page]];
+    quad[0] = firstIndex;
+    quad[1] = firstIndex+1;
+    quad[2] = firstIndex+2;
+    quad[3] = firstIndex+2;
+    quad[4] = firstIndex+3;
+    quad[5] = firstIndex;
+    cursor[font->mImpl->cps[charIDs[i]].page] += 6;
+  }
+}
+
+//-----------------------------------------------------------
+// one pass over the attributes, straight loops without branches per vertex,
+// so that the compiler can vectorize them
+void ofxTrueTypeFontUC::AnimatedText::Impl::expandAttributes(bool shader) {
+  const vector<charPropsUC> &cps = font->mImpl->cps;
+  int n = charIDs.size();
+  for (int i = 0; i < n; ++i) {
+    const GlyphAttributes &a = attributes[i];
+    ofFloatColor color = a.color;
+    if (cps[charIDs[i]].color)
+      color.set(1, 1, 1, a.color.a);
+    for (int j = 0; j < 4; ++j)
+      colors[i*4+j] = color;
+  }
+  
+  if (shader) {
+    for (int i = 0; i < n; ++i) {
+      const GlyphAttributes &a = attributes[i];
+      float transform[4] = {centers[i].x + a.offset.x, centers[i].y + a.offset.y, a.scale, a.rotation * (float)DEG_TO_RAD};
+      for (int j = 0; j < 16; ++j)
+        transforms[i*16+j] = transform[j & 3];
+    }
+    return;
+  }
+  
+  for (int i = 0; i < n; ++i) {
+    const GlyphAttributes &a = attributes[i];
+    float ca = a.scale;
+    float sa = 0;
+    if (a.rotation != 0) {
+      float angle = a.rotation * DEG_TO_RAD;
+      ca = cos(angle) * a.scale;
+      sa = sin(angle) * a.scale;
+    }
+    float cx = centers[i].x + a.offset.x;
+    float cy = centers[i].y + a.offset.y;
+    const ofVec3f *quad = &corners[i*4];
+    for (int j = 0; j < 4; ++j)
+      vertices[i*4+j].set(cx + quad[j].x*ca - quad[j].y*sa, cy + quad[j].x*sa + quad[j].y*ca, 0);
+  }
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::AnimatedText::Impl::upload(bool shader) {
+  int numVertices = charIDs.size() * 4;
+  if (layoutDirty || shader != shaderLayout) {
+    // with the shader the corners and texture coordinates never change again
+    vbo.clear();
+    if (shader) {
+      vbo.setVertexData(&corners[0], numVertices, GL_STATIC_DRAW);
+      vbo.setAttributeData(kTransformAttributeUC, &transforms[0], 4, numVertices, GL_DYNAMIC_DRAW);
+    }
+    else {
+      vbo.setVertexData(&vertices[0], numVertices, GL_DYNAMIC_DRAW);
+    }
+    vbo.setTexCoordData(&texCoords[0], numVertices, GL_STATIC_DRAW);
+    vbo.setColorData(&colors[0], numVertices, GL_DYNAMIC_DRAW);
+    vbo.setIndexData(&indices[0], indices.size(), GL_STATIC_DRAW);
+    shaderLayout = shader;
+    layoutDirty = false;
+    return;
+  }
+  
+  if (shader)
+    vbo.updateAttributeData(kTransformAttributeUC, &transforms[0], numVertices);
+  else
+    vbo.updateVertexData(&vertices[0], numVertices);
+  vbo.updateColorData(&colors[0], numVertices);
+}
+
+//-----------------------------------------------------------
+void ofxTrueTypeFontUC::AnimatedText::draw(float x, float y) {
+  if (!mImpl->refresh()) {
+    ofLogError("ofxTrueTypeFontUC") << "AnimatedText::draw(): font not allocated";
+    return;
+  }
+  ofxTrueTypeFontUC::Impl *fontImpl = mImpl->font->mImpl;
+  if (mImpl->charIDs.empty())
+    return;
+  
+  // only the attributes changed since the last frame, quads stay in the vbo
+  bool shader = useAnimatedShaderUC();
+  mImpl->attributes.resize(mImpl->charIDs.size());
+  if (mImpl->attributesDirty || mImpl->layoutDirty || shader != mImpl->shaderLayout) {
+    mImpl->expandAttributes(shader);
+    mImpl->upload(shader);
+    mImpl->attributesDirty = false;
+  }
+  fontImpl->uploadDirtyPages();
+  
+  ofPushMatrix();
+  ofTranslate(x, y);
+  fontImpl->bind(shader ? &animatedShaderUC : NULL);
+  fontImpl->setVertexColors(true);
+  for (int i = 0; i < (int)mImpl->pageCounts.size(); ++i) {
+    if (mImpl->pageCounts[i] == 0)
+      continue;
+    fontImpl->atlasPages[i].texture.bind();
+    mImpl->vbo.drawElements(GL_TRIANGLES, mImpl->pageCounts[i], mImpl->pageStarts[i]);
+    fontImpl->countDraw(mImpl->pageCounts[i] / 6);
+    fontImpl->atlasPages[i].texture.unbind();
+  }
+  fontImpl->unbind();
+  fontImpl->defragmentStep();
+  ofPopMatrix();
+}
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <string>
 #include "ofRectangle.h"
 #include "ofPath.h"
+#include "ofColor.h"
 
 //--------------------------------------------------
 const static string OF_TTFUC_SANS = "sans-serif";
@@ -14,6 +17,215 @@ const static string OF_TTFUC_MONO = "monospace";
 class ofxTrueTypeFontUC{
   
 public:
+  // a string queued for drawStrings()
+  struct TextItem {
+    TextItem(const string &text="", float x=0, float y=0, const ofFloatColor &color=ofFloatColor(1,1,1,1), float scale=1, float rotation=0)
+    :text(text), position(x,y), color(color), scale(scale), rotation(rotation) {}
+    string text;
+    ofPoint position;
+    ofFloatColor color;
+    float scale;
+    float rotation;  // degrees around position
+  };
+  
+  // a piece of text in one of the styles of the font, see addStyle()
+  struct StyleSpan {
+    StyleSpan(const string &text="", int style=0)
+    :text(text), style(style) {}
+    string text;
+    int style;
+  };
+  
+  // a string that keeps its quads between frames, and only
+  // rewrites and uploads the characters that changed on setText()
+  class MutableText {
+  public:
+    MutableText();
+    MutableText(ofxTrueTypeFontUC &font);
+    ~MutableText();
+    
+    void setFont(ofxTrueTypeFontUC &font);
+    void setText(const string &str);
+    const string & getText();
+    void draw(float x, float y);
+    
+    // editing and caret queries for text input. indices count characters,
+    // not bytes, and positions are relative to the origin of draw(), the
+    // baseline of the first line. edits only lay out what they change
+    void insert(int index, const string &str);
+    void erase(int index, int count);
+    int getNumCharacters();
+    ofPoint getCaretPosition(int index);
+    int getIndexAt(float x, float y);
+    vector<ofRectangle> getSelectionRectangles(int begin, int end);
+    
+  private:
+    class Impl;
+    Impl *mImpl;
+    
+    // disallow copy and assign
+    MutableText(const MutableText &);
+    void operator=(const MutableText &);
+  };
+  
+  // a long multi-line text that decodes and draws only
+  // the lines inside a clip rectangle
+  class TextBlock {
+  public:
+    TextBlock();
+    TextBlock(ofxTrueTypeFontUC &font);
+    ~TextBlock();
+    
+    void setFont(ofxTrueTypeFontUC &font);
+    void setText(const string &str);
+    const string & getText();
+    int getNumLines();
+    float getHeight();
+    
+    // y is the baseline of the first line, clip is in the same space
+    void draw(float x, float y);
+    void draw(float x, float y, const ofRectangle &clip);
+    
+  private:
+    class Impl;
+    Impl *mImpl;
+    
+    // disallow copy and assign
+    TextBlock(const TextBlock &);
+    void operator=(const TextBlock &);
+  };
+  
+  // a scrolling log, each line is laid out once when added and kept
+  // in a circular vertex buffer of at most maxLines lines
+  class Console {
+  public:
+    Console();
+    Console(ofxTrueTypeFontUC &font, int maxLines=1000);
+    ~Console();
+    
+    void setFont(ofxTrueTypeFontUC &font);
+    void setMaxLines(int maxLines);
+    int getMaxLines();
+    
+    // '\n' in line starts new lines
+    void addLine(const string &line);
+    void clear();
+    int getNumLines();
+    
+    // number of lines scrolled back from the newest one
+    void setScroll(float lines);
+    float getScroll();
+    
+    // y is the baseline of the top visible line
+    void draw(float x, float y, int visibleLines);
+    
+  private:
+    class Impl;
+    Impl *mImpl;
+    
+    // disallow copy and assign
+    Console(const Console &);
+    void operator=(const Console &);
+  };
+  
+  // a word wrapped paragraph, characters are decoded and measured
+  // once, so wrapping again at a new width only costs a linear pass
+  class Paragraph {
+  public:
+    Paragraph();
+    Paragraph(ofxTrueTypeFontUC &font);
+    ~Paragraph();
+    
+    void setFont(ofxTrueTypeFontUC &font);
+    void setText(const string &str);
+    const string & getText();
+    
+    // 0 or less doesn't wrap
+    void setMaxWidth(float width);
+    float getMaxWidth();
+    void setAlignment(ofAlignHorz alignment);
+    ofAlignHorz getAlignment();
+    // multiplier of the font's line height
+    void setLineSpacing(float spacing);
+    float getLineSpacing();
+    
+    int getNumLines();
+    float getWidth();
+    float getHeight();
+    
+    // y is the baseline of the first line
+    void draw(float x, float y);
+    
+  private:
+    class Impl;
+    Impl *mImpl;
+    
+    // disallow copy and assign
+    Paragraph(const Paragraph &);
+    void operator=(const Paragraph &);
+  };
+  
+  // a string laid out once, whose glyphs are moved, scaled, turned and
+  // colored every frame. only these attributes are uploaded again, the
+  // programmable renderer applies them in its vertex shader
+  class AnimatedText {
+  public:
+    struct GlyphAttributes {
+      GlyphAttributes() :offset(0,0), scale(1), rotation(0), color(1,1,1,1) {}
+      ofVec2f offset;
+      float scale;  // around the center of the glyph
+      float rotation;  // degrees around the center of the glyph
+      ofFloatColor color;  // alpha included
+    };
+    
+    AnimatedText();
+    AnimatedText(ofxTrueTypeFontUC &font);
+    ~AnimatedText();
+    
+    void setFont(ofxTrueTypeFontUC &font);
+    // the attributes of the glyphs that are still there are kept
+    void setText(const string &str);
+    const string & getText();
+    
+    // glyphs in the order they are laid out, spaces and line breaks have none
+    int getNumGlyphs();
+    ofPoint getGlyphPosition(int index);
+    // edit them in place, the next draw() uploads them
+    vector<GlyphAttributes> & getAttributes();
+    void resetAttributes();
+    
+    // y is the baseline of the first line
+    void draw(float x, float y);
+    
+  private:
+    class Impl;
+    Impl *mImpl;
+    
+    // disallow copy and assign
+    AnimatedText(const AnimatedText &);
+    void operator=(const AnimatedText &);
+  };
+  
+  // the progress of loadAsync(), poll it on the thread that draws the font
+  class AsyncLoad {
+  public:
+    enum Status { PENDING, LOADED, FAILED, CANCELLED };
+    
+    AsyncLoad();
+    // once the worker is done, the first call replaces the font with the
+    // loaded one and uploads its glyphs, on the calling thread
+    Status update();
+    // blocks until the worker is done, then update()
+    Status wait();
+    void cancel();
+    string getError();
+    
+    struct State;
+  private:
+    friend class ofxTrueTypeFontUC;
+    shared_ptr<State> mState;
+  };
+  
   ofxTrueTypeFontUC();
   virtual ~ofxTrueTypeFontUC();
   
@@ -23,14 +235,81 @@ public:
   // 			-- default (without dpi), anti aliased, 96 dpi:
   bool load(string filename, int fontsize, bool bAntiAliased=true, bool makeContours=false, float simplifyAmt=0.3, int dpi=0);
   bool loadFont(string filename, int fontsize, bool bAntiAliased=true, bool makeContours=false, float simplifyAmt=0.3, int dpi=0);
+  // reads and parses the file, and rasterizes the characters of preload,
+  // on a worker thread. until AsyncLoad::update() finishes it, the font keeps
+  // drawing what it had loaded. effects and subpixel phases are taken when
+  // the load starts. loading again or destroying the font cancels it
+  AsyncLoad loadAsync(string filename, int fontsize, bool bAntiAliased=true, bool makeContours=false, float simplifyAmt=0.3, int dpi=0, const string &preload="");
   void reloadFont();
   void unloadFont();
+  // for a lost GL context: the glyphs stay on the cpu side, and
+  // reloadTextures() uploads them again without any FreeType work.
+  // retained text builds its vbos again on its next draw
+  void unloadTextures();
+  void reloadTextures();
+  // keep the cpu copy of the atlas pages that are full run length
+  // encoded, typically a sixth of their size. off by default
+  void setCompactAtlas(bool compact);
+  bool isCompactAtlas();
+  // gives back the atlas space of glyphs that were thrown away, like those
+  // of cleared effects: after each draw, the glyphs of the sparsest page
+  // filled below minOccupancy (at most 0.5) are copied to the newest page
+  // within millisPerFrame, then the page is released. 0 turns it off,
+  // the default
+  void setAtlasDefragmentation(float minOccupancy, float millisPerFrame=0.5);
+  float getAtlasDefragmentation();
   
+  // hebrew and arabic are reordered for display (UAX #9 without explicit
+  // embeddings) per line, by drawString(), getStringBoundingBox(),
+  // getStringAsPoints(), getGlyphRun(), TextBlock and Paragraph. the runs of
+  // the last mixed direction lines are cached, left to right text skips it all
   void drawString(const string &str, float x, float y);
+  // each line is aligned horizontally to x, and the top, center or bottom
+  // of the lines, or the first baseline with OF_ALIGN_VERT_IGNORE, to y.
+  // measured while the quads are built, so it costs the same as drawString()
+  void drawString(const string &str, float x, float y, ofAlignHorz horz, ofAlignVert vert=OF_ALIGN_VERT_IGNORE);
+  // text that is already UTF-16 or UTF-32 is laid out as it is, without going through UTF-8
+  void drawString(const u16string &str, float x, float y);
+  void drawString(const u32string &str, float x, float y);
   void drawStringAsShapes(const string &str, float x, float y);
+  // draw many strings with their own color and transform,
+  // using one draw call per atlas page
+  void drawStrings(const vector<TextItem> &items);
+  void drawStrings(const TextItem *items, size_t count);
+  
+  // effects are rasterized once per glyph into the glyph cache and drawn
+  // behind the text in the order they were added, one draw call per
+  // effect and page, by drawString(), drawStrings(), TextBlock and Paragraph
+  void addOutline(float width, const ofColor &color=ofColor(0));
+  void addShadow(float offsetX, float offsetY, float blur=0, const ofColor &color=ofColor(0,128));
+  void addGlow(float radius, const ofColor &color);
+  void clearEffects();
+  int getNumEffects();
+  
+  // styles are more faces or sizes of a family, like bold or a heading, drawn
+  // from the glyph cache and atlas pages of this font, so mixing them costs
+  // about what plain text does and still takes one draw call per page.
+  // name is the tag of the style in markup. returns the style, 0 being
+  // the font itself, or -1 if the face couldn't be loaded
+  int addStyle(const string &name, string filename, int fontsize);
+  int getStyle(const string &name);
+  int getNumStyles();  // including the font itself
+  void clearStyles();
+  // <name>text</name> for the style of that name, tags nest, and &lt; &gt;
+  // and &amp; are the escaped characters. other tags are kept as text
+  vector<StyleSpan> parseMarkup(const string &markup);
+  // laid out in one pass like drawString(), on a common baseline, and each
+  // line is as high as the tallest style on it. spans aren't shaped
+  void drawSpans(const vector<StyleSpan> &spans, float x, float y);
+  ofRectangle getSpansBoundingBox(const vector<StyleSpan> &spans, float x, float y);
+  void drawMarkup(const string &markup, float x, float y);
   
   vector<ofPath> getStringAsPoints(const string &str, bool vflip=ofIsVFlipped());
+  vector<ofPath> getStringAsPoints(const u16string &str, bool vflip=ofIsVFlipped());
+  vector<ofPath> getStringAsPoints(const u32string &str, bool vflip=ofIsVFlipped());
   ofRectangle getStringBoundingBox(const string &str, float x, float y);
+  ofRectangle getStringBoundingBox(const u16string &str, float x, float y);
+  ofRectangle getStringBoundingBox(const u32string &str, float x, float y);
   
   bool isLoaded();
   bool isAntiAliased();
@@ -47,17 +326,114 @@ public:
   void setSpaceSize(float size);
   
   float stringWidth(const string &str);
+  float stringWidth(const u16string &str);
+  float stringWidth(const u32string &str);
   float stringHeight(const string &str);
+  
+  // cuts every line of str that is wider than maxWidth and ends it with
+  // ellipsis, the table version measures the ellipsis once for all cells
+  string truncateToWidth(const string &str, float maxWidth, const string &ellipsis="...");
+  vector<string> truncateToWidth(const vector<string> &strs, float maxWidth, const string &ellipsis="...");
+  // the largest font size for loadFont() at which str fits in box, from
+  // the unscaled metrics of the face, no size is loaded or rasterized.
+  // 0 when even a size of 1 doesn't fit
+  int fitSizeToBox(const string &str, const ofRectangle &box);
+  
+  // glyphs resolved once, for text laid out or shaped by the caller and
+  // drawn without decoding or character lookups. a glyph handle is valid
+  // until the font is loaded again or reserveCharacters() is called
+  int getGlyph(unsigned int character);
+  // from a raw FreeType glyph index, e.g. the output of a shaper
+  int getGlyphFromIndex(unsigned int glyphIndex);
+  float getGlyphAdvance(int glyph);
+  // str laid out as drawString() would, relative to its first baseline.
+  // spaces and line breaks only move the pen, they have no glyphs
+  void getGlyphRun(const string &str, vector<int> &glyphs, vector<ofPoint> &positions);
+  // positions are pen positions on the baseline, relative to x, y
+  void drawGlyphs(const vector<int> &glyphs, const vector<ofPoint> &positions, float x, float y);
+  void drawGlyphs(const int *glyphs, const ofPoint *positions, size_t count, float x, float y);
+  void drawGlyphIndices(const unsigned int *glyphIndices, const ofPoint *positions, size_t count, float x, float y);
+  ofRectangle getGlyphsBoundingBox(const int *glyphs, const ofPoint *positions, size_t count, float x, float y);
   // get the num of loaded chars
   int getNumCharacters();
   int	getLoadedCharactersCount();
   int getLimitCharactersNum();
   void reserveCharacters(int charactersNumber);
   
+  // glyphs are drawn at whole pixels from variants rasterized at this many
+  // horizontal fractions of a pixel (1 to 4), with fractional advances.
+  // 1, the default, draws a single rasterization at float positions
+  void setSubpixelPhases(int phases);
+  int getSubpixelPhases();
+  
+  // tategaki: lines are columns from right to left, x, y of drawString() the top
+  // of the first one's center line. CJK stays upright with the vertical forms of
+  // punctuation (the vert feature with HarfBuzz), other scripts are turned
+  // clockwise. drawString(), drawStrings(), getStringBoundingBox(),
+  // getStringAsPoints() and TextBlock lay out vertically, alignment is ignored
+  void setVerticalLayout(bool vertical);
+  bool isVerticalLayout();
+  
+  // complex scripts, ligatures and OpenType features by HarfBuzz, which shapes
+  // the runs of each line for drawString(), getStringBoundingBox() and getStringAsPoints().
+  // the addon must be built with OFX_TRUETYPEFONTUC_HARFBUZZ, then it is on by
+  // default. the last runs shaped are cached, see Stats
+  void setShapingEnabled(bool enabled);
+  bool isShapingEnabled();
+  // comma separated, like "-liga,+kern,ss01"
+  void setShapingFeatures(const string &features);
+  string getShapingFeatures();
+  
+  // color glyphs (emoji) are kept in their own RGBA atlas pages of 4MB each,
+  // past this limit the least recently drawn page is evicted and reused
+  void setColorPageLimit(int pages);
+  int getColorPageLimit();
+  
+  // counters of the glyph cache and the renderer, the per frame
+  // ones (lookups to defragmentationMicros) accumulate until resetStats()
+  struct Stats {
+    uint64_t glyphLookups;
+    uint64_t glyphHits;
+    uint64_t glyphMisses;
+    uint64_t rasterizations;
+    uint64_t rasterizationMicros;  // time spent in loadChar
+    uint64_t drawCalls;
+    uint64_t quads;
+    uint64_t bytesDecoded;  // UTF-8 input
+    uint64_t shapedRunHits;  // runs found in the shaping cache
+    uint64_t shapedRunMisses;
+    uint64_t shapingMicros;  // time spent in HarfBuzz
+    uint64_t defragmentedPages;
+    uint64_t movedGlyphs;
+    uint64_t defragmentationMicros;
+    
+    int residentGlyphs;
+    int glyphLimit;
+    int atlasPages;
+    size_t atlasBytes;  // cpu side
+    size_t atlasTextureBytes;
+    float atlasOccupancy;  // live glyph area / page area
+    float atlasFragmentation;  // dead glyph area / packed glyph area
+    size_t outlineBytes;  // outlines and tessellations
+  };
+  Stats getStats();
+  void resetStats();
+  
+  // timeline of loading, rasterization, upload and drawing as Chrome
+  // trace events (chrome://tracing), the addon must be built with
+  // OFX_TRUETYPEFONTUC_TRACING defined, otherwise these do nothing
+  static void setTracingEnabled(bool enabled);
+  static bool isTracingEnabled();
+  static string getTraceJSON();
+  static void clearTrace();
+  
 private:
   class Impl;
   Impl *mImpl;
   
+  // times the internal hot paths, see example-benchmark
+  friend class ofxTrueTypeFontUCBenchmark;
+  
   // disallow copy and assign
   ofxTrueTypeFontUC(const ofxTrueTypeFontUC &);
   void operator=(const ofxTrueTypeFontUC &);